@@ -0,0 +1,144 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "activation.h"
+#include "log.h"
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// First file descriptor passed by the service manager
+static constexpr int ListenFdsStart = 3;
+
+void getActivatedSockets(uint16_t httpPort, ActivatedSockets& sockets)
+{
+	const char *pid = getenv("LISTEN_PID");
+	const char *fds = getenv("LISTEN_FDS");
+	if (pid == nullptr || fds == nullptr || atol(pid) != getpid())
+		return;
+	int count = atoi(fds);
+	std::vector<std::string> names;
+	if (const char *fdNames = getenv("LISTEN_FDNAMES"))
+	{
+		std::string s(fdNames);
+		size_t start = 0;
+		for (size_t pos; (pos = s.find(':', start)) != std::string::npos; start = pos + 1)
+			names.push_back(s.substr(start, pos - start));
+		names.push_back(s.substr(start));
+	}
+	// Not for our children
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+
+	struct Socket
+	{
+		int fd;
+		int type;
+		int family;
+		uint16_t port;
+		std::string name;
+	};
+	std::vector<Socket> activated;
+	for (int fd = ListenFdsStart; fd < ListenFdsStart + count; fd++)
+	{
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		Socket socket { fd, 0, AF_UNSPEC, 0 };
+		if ((size_t)(fd - ListenFdsStart) < names.size())
+			socket.name = names[fd - ListenFdsStart];
+		socklen_t len = sizeof(socket.type);
+		sockaddr_storage addr {};
+		socklen_t addrLen = sizeof(addr);
+		if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &socket.type, &len) < 0
+				|| getsockname(fd, (sockaddr *)&addr, &addrLen) < 0)
+		{
+			WARN_LOG("Ignoring activated file descriptor %d: not a socket", fd);
+			close(fd);
+			continue;
+		}
+		socket.family = addr.ss_family;
+		if (addr.ss_family == AF_INET)
+			socket.port = ntohs(((sockaddr_in *)&addr)->sin_port);
+		else if (addr.ss_family == AF_INET6)
+			socket.port = ntohs(((sockaddr_in6 *)&addr)->sin6_port);
+		activated.push_back(socket);
+	}
+	// HTTP socket: bound to the HTTP port, or else named "http"
+	for (const Socket& socket : activated)
+		if (socket.type == SOCK_STREAM && socket.port == httpPort)
+			sockets.httpFd = socket.fd;
+	for (const Socket& socket : activated)
+		if (sockets.httpFd < 0 && socket.type == SOCK_STREAM && socket.name == "http")
+			sockets.httpFd = socket.fd;
+	if (sockets.httpFd >= 0)
+		INFO_LOG("Using activated HTTP socket");
+
+	for (const Socket& socket : activated)
+	{
+		if (socket.fd == sockets.httpFd)
+			continue;
+		if (socket.family != AF_INET)
+		{
+			// Players are identified by their IPv4 address
+			WARN_LOG("Ignoring activated socket on port %d: game sockets must be bound to an IPv4 address", socket.port);
+			close(socket.fd);
+		}
+		else if (socket.type == SOCK_STREAM) {
+			sockets.gameTcpFds[socket.port] = socket.fd;
+		}
+		else if (socket.type == SOCK_DGRAM && socket.port > 0) {
+			sockets.gameUdpFds[socket.port - 1] = socket.fd;
+		}
+		else
+		{
+			WARN_LOG("Ignoring activated socket %d of type %d", socket.fd, socket.type);
+			close(socket.fd);
+		}
+	}
+	if (!sockets.gameTcpFds.empty() || !sockets.gameUdpFds.empty())
+		INFO_LOG("Using %zd activated game socket(s)", sockets.gameTcpFds.size() + sockets.gameUdpFds.size());
+}
+
+void notifyServiceManager(const std::string& state)
+{
+	const char *path = getenv("NOTIFY_SOCKET");
+	if (path == nullptr || (path[0] != '/' && path[0] != '@'))
+		return;
+	sockaddr_un addr {};
+	size_t pathLen = strlen(path);
+	if (pathLen >= sizeof(addr.sun_path))
+		return;
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path, path, pathLen);
+	if (path[0] == '@')
+		// Abstract namespace
+		addr.sun_path[0] = '\0';
+	int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return;
+	if (sendto(fd, state.data(), state.length(), 0, (sockaddr *)&addr, offsetof(sockaddr_un, sun_path) + pathLen) < 0)
+		WARN_LOG("Can't notify the service manager: %s", strerror(errno));
+	close(fd);
+}
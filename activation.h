@@ -0,0 +1,38 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+/// Sockets passed by the service manager (systemd socket activation, LISTEN_FDS protocol)
+struct ActivatedSockets
+{
+	int httpFd = -1;
+	std::unordered_map<uint16_t, int> gameTcpFds;	// listening sockets by game port
+	std::unordered_map<uint16_t, int> gameUdpFds;	// UDP sockets by game port (UDP port - 1)
+};
+
+/// Collects the sockets passed with LISTEN_FDS, if any.
+/// The HTTP socket is the TCP socket bound to httpPort or else the one named "http".
+/// The other IPv4 sockets are used by the games on their port.
+void getActivatedSockets(uint16_t httpPort, ActivatedSockets& sockets);
+
+/// Sends a state change to the service manager (sd_notify protocol), if any.
+/// Example: "READY=1"
+void notifyServiceManager(const std::string& state);
@@ -0,0 +1,289 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+//
+// Micro-benchmarks of the server hot paths. Run with `make bench`.
+//
+#include "http.h"
+#include "game.h"
+#include "player.h"
+#include "codec.h"
+#include "db.h"
+#include "log.h"
+#include <sqlite3.h>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+// Count memory allocations by interposing the libc allocator
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *p, size_t size);
+
+static uint64_t allocCount;
+
+extern "C" void *malloc(size_t size) {
+	allocCount++;
+	return __libc_malloc(size);
+}
+extern "C" void *calloc(size_t n, size_t size) {
+	allocCount++;
+	return __libc_calloc(n, size);
+}
+extern "C" void *realloc(void *p, size_t size) {
+	allocCount++;
+	return __libc_realloc(p, size);
+}
+
+template<typename T>
+static inline void doNotOptimize(const T& value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template<typename F>
+static void bench(const char *name, F f)
+{
+	using the_clock = std::chrono::steady_clock;
+	// Warm up and find an iteration count that runs for about 200 ms
+	uint64_t iterations = 1;
+	for (;;)
+	{
+		auto start = the_clock::now();
+		for (uint64_t i = 0; i < iterations; i++)
+			f();
+		if (the_clock::now() - start > std::chrono::milliseconds(20))
+			break;
+		iterations *= 2;
+	}
+	iterations *= 10;
+	const uint64_t allocStart = allocCount;
+	auto start = the_clock::now();
+	for (uint64_t i = 0; i < iterations; i++)
+		f();
+	auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(the_clock::now() - start).count();
+	const uint64_t allocs = allocCount - allocStart;
+	printf("%-34s %12.1f ns/op %8.2f allocs/op\n", name, (double)duration / iterations, (double)allocs / iterations);
+}
+
+// Access to the private functions being measured
+class BenchAccess
+{
+public:
+	static bool urlDecode(const std::string& in, std::string& out) {
+		return RequestHandler::urlDecode(in, out);
+	}
+	static bool packetMatcher(asio::const_buffers_1 buffer) {
+		return GameConnection::packetMatcher(GameConnection::iterator::begin(buffer),
+				GameConnection::iterator::end(buffer)).second;
+	}
+	// Players normally receive on port 7980
+	static void setUdpPort(Player& player, uint16_t port) {
+		player.endpoint.port(port);
+	}
+};
+
+class BenchServer : public Server
+{
+public:
+	void deleteGame(Game::Ptr game) override {
+	}
+};
+
+static Player::Ptr createPlayer(asio::io_context& io_context, asio::ip::tcp::acceptor& acceptor,
+		std::vector<asio::ip::tcp::socket>& clients, Game::Ptr game, const std::string& name, bool alien,
+		uint16_t udpPort)
+{
+	clients.emplace_back(io_context);
+	clients.back().connect(acceptor.local_endpoint());
+	GameConnection::Ptr connection = GameConnection::create(io_context);
+	acceptor.accept(connection->getSocket());
+	Player::Ptr player = Player::create(connection, game, game->newConnectionId());
+	player->setName(name);
+	BenchAccess::setUdpPort(*player, udpPort);
+	uint8_t extraData[8] { 0, (uint8_t)alien, 2, 3, 4, 5, 6, 7 };
+	player->setExtraData(extraData);
+	player->assignSlot(alien);
+	return player;
+}
+
+static bool createDatabase(const std::string& path)
+{
+	std::ifstream file("createdb.sql");
+	if (!file) {
+		fprintf(stderr, "createdb.sql not found\n");
+		return false;
+	}
+	std::stringstream sql;
+	sql << file.rdbuf();
+	unlink(path.c_str());
+	sqlite3 *db;
+	if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+		return false;
+	char *error = nullptr;
+	bool ret = sqlite3_exec(db, sql.str().c_str(), nullptr, nullptr, &error) == SQLITE_OK;
+	if (!ret) {
+		fprintf(stderr, "createdb.sql: %s\n", error);
+		sqlite3_free(error);
+	}
+	if (ret)
+	{
+		// Representative ranking size
+		sqlite3_exec(db, "BEGIN", nullptr, nullptr, nullptr);
+		sqlite3_stmt *stmt;
+		sqlite3_prepare_v2(db, "INSERT INTO RANKING (PLAYER_NAME, SCORE, ARCADE_NAME, CITY, STATE, DATE) "
+				"VALUES (?, ?, 'FLYCAST', 'PARIS', 'FR', strftime('%s'))", -1, &stmt, nullptr);
+		for (int i = 0; i < 5000; i++)
+		{
+			const std::string name = "P" + std::to_string(i);
+			sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+			sqlite3_bind_int(stmt, 2, (i * 7919) % 250000);
+			sqlite3_step(stmt);
+			sqlite3_reset(stmt);
+		}
+		sqlite3_finalize(stmt);
+		ret = sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) == SQLITE_OK;
+	}
+	sqlite3_close(db);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	setLogLevel(Log::INFO);
+	// HTTP
+	{
+		const std::string httpRequest = "POST /cgi-bin/AFODC/CGI/AFODCCGI HTTP/1.0\r\n"
+				"Host: dcnet.flyca.st\r\n"
+				"Content-Type: application/x-www-form-urlencoded\r\n"
+				"Content-Length: 9\r\n"
+				"\r\n"
+				"Request=0";
+		bench("RequestParser::parse", [&]() {
+			Request request;
+			RequestParser parser;
+			auto result = parser.parse(request, httpRequest.data(), httpRequest.data() + httpRequest.length());
+			doNotOptimize(result);
+		});
+		const std::string url = "/cgi-bin/AFODC/CGI/AFODCCGI?Request%3D0%26Data1%3D00+11";
+		std::string decoded;
+		bench("RequestHandler::urlDecode", [&]() {
+			BenchAccess::urlDecode(url, decoded);
+			doNotOptimize(decoded);
+		});
+	}
+	// Game
+	{
+		asio::io_context io_context;
+		BenchServer server;
+		asio::ip::udp::socket gameSocket(io_context, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+		const uint16_t gamePort = gameSocket.local_endpoint().port() - 1;
+		Game::Ptr game = Game::create(server, io_context, "127.0.0.1", gamePort, -1, gameSocket.release());
+		game->setName("Bench game");
+		game->setType(Game::DeathMatch);
+		game->setMaps(63);
+		game->setSlots({ Game::Open, Game::Open, Game::Open, Game::Open, Game::Open, Game::Open, Game::Open, Game::Open });
+		asio::ip::tcp::acceptor acceptor(io_context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), 0));
+		std::vector<asio::ip::tcp::socket> clients;
+		// Excess packets are dropped by the kernel
+		asio::ip::udp::socket udpSink(io_context, asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0));
+		std::vector<Player::Ptr> players;
+		for (int i = 0; i < 6; i++)
+			players.push_back(createPlayer(io_context, acceptor, clients, game, "PLAYER" + std::to_string(i), i % 2 == 1,
+					udpSink.local_endpoint().port()));
+
+		bench("Game::getHttpDesc(false)", [&]() {
+			std::string s = game->getHttpDesc(false);
+			doNotOptimize(s);
+		});
+		bench("Game::getHttpDesc(true)", [&]() {
+			std::string s = game->getHttpDesc(true);
+			doNotOptimize(s);
+		});
+		bench("Game::updatePlayerList", [&]() {
+			game->updatePlayerList(2);
+			doNotOptimize(game->getPlayerListPacket());
+		});
+		// 0x78 packet from slot 0 relayed to the 5 other players
+		const uint8_t udpPacket[] { 0x10, 0x00, 0x78, 0x01, 0x00, 0x00, 0x00, 0x04,
+			0x08, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+		const asio::ip::udp::endpoint udpSource(asio::ip::address_v4::loopback(), 7980);
+		bench("Game::udpReceived (5 recipients)", [&]() {
+			game->udpReceived(udpPacket, sizeof(udpPacket), udpSource);
+		});
+		bench("GameConnection::create", [&]() {
+			GameConnection::Ptr connection = GameConnection::create(io_context);
+			doNotOptimize(connection);
+		});
+	}
+	// TCP packet framing
+	{
+		const uint8_t packet[] { 0x14, 0x00, 0x01, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+			0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10 };
+		const auto buffer = asio::buffer(packet);
+		bench("GameConnection::packetMatcher", [&]() {
+			bool result = BenchAccess::packetMatcher(buffer);
+			doNotOptimize(result);
+		});
+	}
+	// Lobby and ranking parameters
+	{
+		const std::string data4 = scramble(std::string("c*16:i:i:c*8:c*8\0Bench game\0\0\0\0\0\0"
+				"\3\0\0\0\77\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\1\1\1\1", 57));
+		bench("hexStringToBytes+descramble", [&]() {
+			std::string s = descramble(data4);
+			doNotOptimize(s);
+		});
+		static const unsigned char DreamcastKey[] = { 0xd4, 0x61, 0xdb, 0x19, 0x4a, 0x30, 0x17, 0xbc };
+		const std::string ciphered = "6F7A3A2CC0AD8C0E1F5D0B1E1A6B6A4D2D1F5C8E99C2E1B7A1A6D3D2C9F0B8E7";
+		bench("decrypt", [&]() {
+			std::string s = decrypt(ciphered, DreamcastKey);
+			doNotOptimize(s);
+		});
+	}
+	// Database
+	{
+		const std::string dbPath = "/tmp/afobench.db";
+		if (createDatabase(dbPath))
+		{
+			setDatabasePath(dbPath);
+			bench("getTop10Scores", []() {
+				std::string s = getTop10Scores();
+				doNotOptimize(s);
+			});
+			unlink(dbPath.c_str());
+		}
+	}
+	// Logging
+	{
+		fflush(stderr);
+		int savedStderr = dup(STDERR_FILENO);
+		int devNull = open("/dev/null", O_WRONLY);
+		dup2(devNull, STDERR_FILENO);
+		close(devNull);
+		bench("logger", []() {
+			INFO_LOG("[port %d] Player %s left game %s", 9400, "PLAYER1", "Bench game");
+		});
+		fflush(stderr);
+		dup2(savedStderr, STDERR_FILENO);
+		close(savedStderr);
+	}
+
+	return 0;
+}
@@ -0,0 +1,69 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "capacity.h"
+#include <algorithm>
+#include <cstdio>
+#include <unistd.h>
+
+static unsigned MaxGames;
+static size_t MemoryBudget;
+
+void setMaxGames(unsigned count) {
+	MaxGames = count;
+}
+
+void setMemoryBudget(size_t bytes) {
+	MemoryBudget = bytes;
+}
+
+unsigned Capacity::getMaxGames() {
+	return MaxGames;
+}
+
+size_t Capacity::getMemoryBudget() {
+	return MemoryBudget;
+}
+
+void Capacity::sampleMemory()
+{
+	FILE *f = fopen("/proc/self/statm", "r");
+	if (f == nullptr)
+		return;
+	unsigned long size, resident;
+	if (fscanf(f, "%lu %lu", &size, &resident) == 2)
+		residentMemory = resident * sysconf(_SC_PAGESIZE);
+	fclose(f);
+}
+
+size_t Capacity::getFreeGames(size_t games) const
+{
+	size_t freeGames = portPool.available();
+	if (MaxGames != 0)
+		freeGames = std::min(freeGames, games >= MaxGames ? 0 : MaxGames - games);
+	if (MemoryBudget != 0)
+		freeGames = std::min(freeGames, residentMemory >= MemoryBudget ? 0 : (MemoryBudget - residentMemory) / GameMemory);
+	return freeGames;
+}
+
+bool Capacity::admit(size_t games)
+{
+	if (getFreeGames(games) != 0)
+		return true;
+	rejected++;
+	return false;
+}
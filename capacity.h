@@ -0,0 +1,60 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "portpool.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/// Maximum number of concurrent games. 0: only limited by the number of ports.
+void setMaxGames(unsigned count);
+/// Resident memory above which no new game is created. 0: no limit.
+void setMemoryBudget(size_t bytes);
+
+/// Admission control of new games.
+/// A game is only created if a port is free, the maximum number of games isn't reached
+/// and the memory used by the process leaves room for it in the memory budget.
+/// The resident memory is sampled periodically so that admission never blocks.
+class Capacity
+{
+public:
+	explicit Capacity(const PortPool& portPool) : portPool(portPool) {}
+
+	/// Samples the resident memory of the process
+	void sampleMemory();
+	/// Returns the number of games that can still be created
+	size_t getFreeGames(size_t games) const;
+	/// Returns true if a new game can be created, otherwise counts the rejection
+	bool admit(size_t games);
+
+	size_t getResidentMemory() const {
+		return residentMemory;
+	}
+	uint64_t getRejectedCount() const {
+		return rejected;
+	}
+	static unsigned getMaxGames();
+	static size_t getMemoryBudget();
+
+	/// Rough upper bound of the memory used by a full game with spectators and packet capture
+	static constexpr size_t GameMemory = 256 * 1024;
+
+private:
+	const PortPool& portPool;
+	size_t residentMemory = 0;
+	uint64_t rejected = 0;
+};
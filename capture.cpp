@@ -0,0 +1,214 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "capture.h"
+#include "log.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+static std::string CaptureDirectory;
+static std::atomic<uint64_t> dropCount;
+
+// Writes capture buffers to disk in a background thread
+class CaptureWriter
+{
+public:
+	static CaptureWriter& instance() {
+		static CaptureWriter writer;
+		return writer;
+	}
+
+	~CaptureWriter()
+	{
+		{
+			std::lock_guard<std::mutex> _(mutex);
+			stopping = true;
+		}
+		cond.notify_one();
+		if (thread.joinable())
+			thread.join();
+	}
+
+	// records is the number of records in data, dropped if the disk can't keep up.
+	// The first keep bytes are always written.
+	void post(FILE *file, std::vector<uint8_t>&& data, unsigned records, size_t keep, bool close)
+	{
+		{
+			std::lock_guard<std::mutex> _(mutex);
+			if (!thread.joinable())
+				thread = std::thread(&CaptureWriter::run, this);
+			if (queue.size() >= MaxQueuedJobs)
+			{
+				if (dropCount.fetch_add(records, std::memory_order_relaxed) == 0)
+					WARN_LOG("Capture files can't be written fast enough: dropping records");
+				if (!close && keep == 0)
+					return;
+				data.resize(keep);
+			}
+			queue.push_back({ file, std::move(data), close });
+		}
+		cond.notify_one();
+	}
+
+private:
+	struct Job
+	{
+		FILE *file;
+		std::vector<uint8_t> data;
+		bool close;
+	};
+
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		for (;;)
+		{
+			cond.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty())
+				break;
+			Job job = std::move(queue.front());
+			queue.pop_front();
+			lock.unlock();
+			if (!job.data.empty() && fwrite(job.data.data(), job.data.size(), 1, job.file) != 1)
+				ERROR_LOG("Capture file write failed: %s", strerror(errno));
+			if (job.close)
+				fclose(job.file);
+			lock.lock();
+		}
+	}
+
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::deque<Job> queue;
+	std::thread thread;
+	bool stopping = false;
+
+	// About 16 MB of capture buffers
+	static constexpr size_t MaxQueuedJobs = 256;
+};
+
+void setCaptureDirectory(const std::string& path)
+{
+	CaptureDirectory = path;
+	// make sure the writer is destroyed (and flushed) after all captures
+	if (!path.empty())
+		CaptureWriter::instance();
+}
+
+std::unique_ptr<PacketCapture> PacketCapture::open(uint16_t port)
+{
+	if (CaptureDirectory.empty())
+		return nullptr;
+	time_t now = time(nullptr);
+	struct tm tm = *localtime(&now);
+	char name[64];
+	snprintf(name, sizeof(name), "/afo-%04d%02d%02d-%02d%02d%02d-%d.pcap",
+			tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, port);
+	std::string path = CaptureDirectory + name;
+	FILE *file = fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		ERROR_LOG("Can't create capture file %s: %s", path.c_str(), strerror(errno));
+		return nullptr;
+	}
+	INFO_LOG("[port %d] Capturing game traffic to %s", port, path.c_str());
+	return std::unique_ptr<PacketCapture>(new PacketCapture(file, port));
+}
+
+PacketCapture::PacketCapture(FILE *file, uint16_t port)
+	: file(file), port(port)
+{
+	buffer.reserve(FlushThreshold + 2048);
+	// pcap global header
+	struct {
+		uint32_t magic;
+		uint16_t versionMajor;
+		uint16_t versionMinor;
+		int32_t thisZone;
+		uint32_t sigFigs;
+		uint32_t snapLen;
+		uint32_t linkType;
+	} header { 0xa1b2c3d4, 2, 4, 0, 0, 65535, LinkType };
+	buffer.resize(sizeof(header));
+	memcpy(buffer.data(), &header, sizeof(header));
+	headerSize = sizeof(header);
+}
+
+PacketCapture::~PacketCapture()
+{
+	CaptureWriter::instance().post(file, std::move(buffer), records, headerSize, true);
+}
+
+void PacketCapture::write(Protocol protocol, Direction direction, int slot, unsigned connection,
+		const uint8_t *data, size_t len)
+{
+	writeRecord(protocol, direction, slot, connection, nullptr, 0, data, len);
+}
+
+void PacketCapture::writeTcp(Direction direction, int slot, unsigned connection, uint8_t opcode,
+		const uint8_t *payload, size_t size)
+{
+	const uint8_t header[] { (uint8_t)(size + 3), (uint8_t)((size + 3) >> 8), opcode };
+	writeRecord(Tcp, direction, slot, connection, header, sizeof(header), payload, size);
+}
+
+void PacketCapture::writeRecord(Protocol protocol, Direction direction, int slot, unsigned connection,
+		const uint8_t *header, size_t headerLen, const uint8_t *data, size_t len)
+{
+	auto now = std::chrono::system_clock::now().time_since_epoch();
+	auto usecs = std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+	const uint32_t recordLen = sizeof(RecordHeader) + headerLen + len;
+	const uint32_t pcapHeader[] { (uint32_t)(usecs / 1000000), (uint32_t)(usecs % 1000000), recordLen, recordLen };
+	const RecordHeader recHeader { port, protocol, direction, (int8_t)slot, 0, (uint16_t)connection };
+
+	size_t offset = buffer.size();
+	buffer.resize(offset + sizeof(pcapHeader) + recordLen);
+	uint8_t *p = &buffer[offset];
+	memcpy(p, pcapHeader, sizeof(pcapHeader));
+	p += sizeof(pcapHeader);
+	memcpy(p, &recHeader, sizeof(recHeader));
+	p += sizeof(recHeader);
+	if (headerLen != 0) {
+		memcpy(p, header, headerLen);
+		p += headerLen;
+	}
+	if (len != 0)
+		memcpy(p, data, len);
+	records++;
+	if (buffer.size() >= FlushThreshold)
+		flush();
+}
+
+void PacketCapture::flush()
+{
+	std::vector<uint8_t> data;
+	data.reserve(FlushThreshold + 2048);
+	std::swap(data, buffer);
+	CaptureWriter::instance().post(file, std::move(data), records, headerSize, false);
+	records = 0;
+	headerSize = 0;
+}
+
+uint64_t getCaptureDropCount() {
+	return dropCount.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,86 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// Captures the traffic of a game into a pcap file (link type USER0).
+/// Each captured packet is prefixed with a RecordHeader.
+/// Records are buffered and written to disk by a background thread.
+/// If the disk can't keep up, the buffers in excess are dropped.
+class PacketCapture
+{
+public:
+	enum Protocol : uint8_t {
+		Udp = 0,
+		Tcp = 1,
+		Info = 2,	// Game description (Game::getHttpDesc)
+	};
+	enum Direction : uint8_t {
+		In = 0,		// client to server
+		Out = 1,	// server to client
+	};
+
+#pragma pack(push, 1)
+	struct RecordHeader
+	{
+		uint16_t port;		// game TCP port
+		uint8_t protocol;
+		uint8_t direction;
+		int8_t slot;		// -1 for spectators and unknown sources
+		uint8_t reserved;
+		uint16_t connection;	// connection number in the game, 0 if unknown
+	};
+#pragma pack(pop)
+	static_assert(sizeof(RecordHeader) == 8, "RecordHeader must be 8 bytes");
+
+	static constexpr uint32_t LinkType = 147;	// LINKTYPE_USER0
+
+	/// Opens a new capture file for the game using the specified port.
+	/// Returns nullptr if capture is disabled or the file can't be created.
+	static std::unique_ptr<PacketCapture> open(uint16_t port);
+	~PacketCapture();
+
+	void write(Protocol protocol, Direction direction, int slot, unsigned connection,
+			const uint8_t *data, size_t len);
+	/// Writes a TCP packet given its opcode and payload.
+	void writeTcp(Direction direction, int slot, unsigned connection, uint8_t opcode,
+			const uint8_t *payload, size_t size);
+
+private:
+	PacketCapture(FILE *file, uint16_t port);
+	void writeRecord(Protocol protocol, Direction direction, int slot, unsigned connection,
+			const uint8_t *header, size_t headerLen, const uint8_t *data, size_t len);
+	void flush();
+
+	FILE *file;
+	uint16_t port;
+	std::vector<uint8_t> buffer;
+	unsigned records = 0;	// number of records in buffer
+	size_t headerSize = 0;	// pcap header at the start of buffer, not written yet
+
+	static constexpr size_t FlushThreshold = 64 * 1024;
+};
+
+void setCaptureDirectory(const std::string& path);
+/// Number of capture records dropped because the disk was too slow
+uint64_t getCaptureDropCount();
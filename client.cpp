@@ -0,0 +1,212 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "client.h"
+#include "codec.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+namespace
+{
+
+class HttpRequest : public std::enable_shared_from_this<HttpRequest>
+{
+public:
+	HttpRequest(asio::io_context& io_context, HttpCallback callback)
+		: socket(io_context), timer(io_context), callback(callback) {
+	}
+
+	void start(const asio::ip::tcp::endpoint& server, const char *method, const std::string& uri,
+			const std::string& body, asio::chrono::milliseconds timeout)
+	{
+		request = std::string(method) + " " + uri + " HTTP/1.0\r\n"
+				"Host: " + server.address().to_string() + "\r\n";
+		if (!body.empty())
+			request += "Content-Type: application/x-www-form-urlencoded\r\n"
+					"Content-Length: " + std::to_string(body.length()) + "\r\n";
+		request += "\r\n" + body;
+		if (timeout.count() != 0)
+		{
+			timer.expires_after(timeout);
+			timer.async_wait([self = shared_from_this()](const std::error_code& ec) {
+				if (ec)
+					return;
+				self->timedOut = true;
+				std::error_code ignored;
+				self->socket.close(ignored);
+			});
+		}
+		socket.async_connect(server,
+			[self = shared_from_this()](const std::error_code& ec)
+			{
+				if (ec)
+					self->complete(ec, 0, {});
+				else
+					self->write();
+			});
+	}
+
+private:
+	void write()
+	{
+		asio::async_write(socket, asio::buffer(request),
+			[self = shared_from_this()](const std::error_code& ec, size_t)
+			{
+				if (ec)
+					self->complete(ec, 0, {});
+				else
+					self->read();
+			});
+	}
+
+	void read()
+	{
+		asio::async_read(socket, asio::dynamic_buffer(reply),
+			[self = shared_from_this()](const std::error_code& ec, size_t)
+			{
+				if (ec && ec != asio::error::eof) {
+					self->complete(ec, 0, {});
+					return;
+				}
+				self->parseReply();
+			});
+	}
+
+	void parseReply()
+	{
+		// HTTP/1.x <status> <reason>
+		int status = 0;
+		size_t pos = reply.find(' ');
+		if (pos != std::string::npos)
+			status = atoi(&reply[pos + 1]);
+		pos = reply.find("\r\n\r\n");
+		if (pos == std::string::npos)
+			complete(asio::error::make_error_code(asio::error::invalid_argument), status, {});
+		else
+			complete({}, status, reply.substr(pos + 4));
+	}
+
+	void complete(const std::error_code& ec, int status, const std::string& content)
+	{
+		timer.cancel();
+		if (timedOut)
+			callback(asio::error::make_error_code(asio::error::timed_out), 0, {});
+		else
+			callback(ec, status, content);
+	}
+
+	asio::ip::tcp::socket socket;
+	asio::steady_timer timer;
+	bool timedOut = false;
+	HttpCallback callback;
+	std::string request;
+	std::string reply;
+};
+
+}
+
+void httpPost(asio::io_context& io_context, const asio::ip::tcp::endpoint& server,
+		const std::string& path, const std::string& body, HttpCallback callback)
+{
+	httpRequest(io_context, server, "POST", "/cgi-bin/" + path, body, asio::chrono::milliseconds(0), callback);
+}
+
+void httpRequest(asio::io_context& io_context, const asio::ip::tcp::endpoint& server, const char *method,
+		const std::string& uri, const std::string& body, asio::chrono::milliseconds timeout, HttpCallback callback)
+{
+	std::make_shared<HttpRequest>(io_context, callback)->start(server, method, uri, body, timeout);
+}
+
+std::string createGameRequest(const std::string& gameName, unsigned gameType, unsigned maps,
+		const std::array<uint8_t, 8>& slots, const std::string& playerName)
+{
+	// Request=c:2
+	std::string request("c\0\2", 3);
+	// Data3=c*8:c:c:c:c:s:c:c player name and unknown info
+	std::string data3("c*8:c:c:c:c:s:c:c", 18);
+	data3.append(playerName.substr(0, 8));
+	data3.resize(18 + 16);
+	// Data4=c*16:i:i:c*8:c*8 game name, type, maps, slots and sides
+	std::string data4("c*16:i:i:c*8:c*8", 17);
+	data4.append(gameName.substr(0, 15));
+	data4.resize(33);
+	data4.append((const char *)&gameType, 4);
+	data4.append((const char *)&maps, 4);
+	data4.append((const char *)slots.data(), slots.size());
+	data4.append("\0\0\0\0\1\1\1\1", 8);
+
+	return "Request=" + scramble(request)
+			+ " Data3=" + scramble(data3)
+			+ " Data4=" + scramble(data4);
+}
+
+std::string listGamesRequest() {
+	// Request=c:0
+	return "Request=" + scramble(std::string("c\0\0", 3));
+}
+
+int parseGamePort(const std::string& reply)
+{
+	size_t pos = reply.find("Port=");
+	if (pos == std::string::npos)
+		return -1;
+	return atoi(&reply[pos + 5]);
+}
+
+std::vector<uint8_t> loginPacket(const std::string& playerName, bool alien, bool spectator)
+{
+	std::vector<uint8_t> pkt(43);
+	pkt[0] = (uint8_t)pkt.size();
+	pkt[2] = 0;
+	// UDP port 7980
+	pkt[5] = 7980 >> 8;
+	pkt[6] = 7980 & 0xff;
+	pkt[7] = spectator ? 0 : 1;
+	memcpy(&pkt[27], playerName.c_str(), std::min<size_t>(playerName.length(), 7));
+	// extra data
+	pkt[36] = alien ? 1 : 0;
+	return pkt;
+}
+
+asio::ip::address_v4 clientAddress(unsigned group, unsigned client)
+{
+	// 127.<1 + group / 256>.<group % 256>.<client>
+	return asio::ip::address_v4((127u << 24) | ((1 + group / 256) << 16)
+			| ((group % 256) << 8) | (1 + client % 254));
+}
+
+void printPercentiles(const char *name, std::vector<uint32_t>& values)
+{
+	if (values.empty()) {
+		printf("%s: no samples\n", name);
+		return;
+	}
+	std::sort(values.begin(), values.end());
+	auto pct = [&values](double p) {
+		return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+	};
+	printf("%s (us): p50 %u  p90 %u  p99 %u  p99.9 %u  max %u  (%zd samples)\n", name,
+			pct(0.5), pct(0.9), pct(0.99), pct(0.999), values.back(), values.size());
+}
+
+void ClientStats::printLatencies()
+{
+	printPercentiles("Game creation latency", createLatencies);
+	printPercentiles("UDP relay latency", relayLatencies);
+}
@@ -0,0 +1,68 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "asio.h"
+#include <array>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Helpers shared by the tools simulating Dreamcast/Naomi clients, and by the cluster lobby
+
+/// Sends an HTTP/1.0 POST request to /cgi-bin/<path> and calls the callback with the reply content.
+using HttpCallback = std::function<void(const std::error_code& ec, int status, const std::string& content)>;
+void httpPost(asio::io_context& io_context, const asio::ip::tcp::endpoint& server,
+		const std::string& path, const std::string& body, HttpCallback callback);
+/// Sends an HTTP/1.0 request. The request fails with asio::error::timed_out
+/// if the reply isn't received within the timeout (0: no timeout).
+void httpRequest(asio::io_context& io_context, const asio::ip::tcp::endpoint& server, const char *method,
+		const std::string& uri, const std::string& body, asio::chrono::milliseconds timeout, HttpCallback callback);
+
+/// Returns the AFODCCGI request body that creates a new game.
+std::string createGameRequest(const std::string& gameName, unsigned gameType, unsigned maps,
+		const std::array<uint8_t, 8>& slots, const std::string& playerName = "");
+
+/// Returns the AFODCCGI request body that lists the current games.
+std::string listGamesRequest();
+
+/// Returns the value of the Port= parameter in an AFODCCGI reply, or -1 if not found.
+int parseGamePort(const std::string& reply);
+
+/// Returns a game login packet (TCP packet type 0)
+std::vector<uint8_t> loginPacket(const std::string& playerName, bool alien, bool spectator = false);
+
+/// Returns the loopback address used by a simulated client.
+/// Each client needs its own address since the server identifies UDP peers by IP address.
+asio::ip::address_v4 clientAddress(unsigned group, unsigned client);
+
+/// Counters and latencies collected by the client simulation tools
+struct ClientStats
+{
+	uint64_t udpSent = 0;
+	uint64_t udpReceived = 0;
+	unsigned gamesCreated = 0;
+	unsigned gamesFailed = 0;
+	std::vector<uint32_t> createLatencies;	// game creation latency in microseconds
+	std::vector<uint32_t> relayLatencies;	// UDP relay latency in microseconds
+
+	/// Prints the percentiles of the game creation and UDP relay latencies
+	void printLatencies();
+};
+
+/// Prints the p50, p90, p99, p99.9 and max of a list of microsecond values. The values are sorted in place.
+void printPercentiles(const char *name, std::vector<uint32_t>& values);
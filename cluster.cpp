@@ -0,0 +1,300 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "cluster.h"
+#include "client.h"
+#include "log.h"
+#include <cstdlib>
+
+static std::vector<asio::ip::address> LobbyAddresses;
+
+void writeNodeReport(std::string& out, const std::string& serverIp, uint16_t portMin, uint16_t portMax,
+		size_t freeGames, const std::vector<Game::Ptr>& games)
+{
+	out = "ServerIP=" + serverIp + "\n"
+			"Ports=" + std::to_string(portMin) + "-" + std::to_string(portMax) + "\n"
+			"FreeGames=" + std::to_string(freeGames) + "\n";
+	for (const auto& game : games)
+		out += "Game=" + game->getHttpDesc(false) + "\n"
+				"Details=" + game->getHttpDesc(true) + "\n";
+}
+
+void setLobbyAddresses(const std::string& addresses)
+{
+	LobbyAddresses.clear();
+	for (size_t pos = 0; pos < addresses.length();)
+	{
+		size_t end = addresses.find_first_of(" ,", pos);
+		if (end == std::string::npos)
+			end = addresses.length();
+		std::string address = addresses.substr(pos, end - pos);
+		pos = end + 1;
+		if (address.empty())
+			continue;
+		std::error_code ec;
+		asio::ip::address ip = asio::ip::make_address(address, ec);
+		if (ec) {
+			ERROR_LOG("Invalid lobby address: %s", address.c_str());
+			continue;
+		}
+		LobbyAddresses.push_back(ip);
+	}
+}
+
+bool isLobbyAddress(asio::ip::address address)
+{
+	if (address.is_v6() && address.to_v6().is_v4_mapped())
+		address = asio::ip::make_address_v4(asio::ip::v4_mapped, address.to_v6());
+	if (address.is_loopback())
+		return true;
+	for (const auto& lobby : LobbyAddresses)
+		if (lobby == address)
+			return true;
+	return false;
+}
+
+void NodeReport::parse(const std::string& content)
+{
+	serverIp.clear();
+	ports.clear();
+	freeGames = 0;
+	games.clear();
+	for (size_t pos = 0; pos < content.length();)
+	{
+		size_t end = content.find('\n', pos);
+		if (end == std::string::npos)
+			end = content.length();
+		size_t equal = content.find('=', pos);
+		if (equal < end)
+		{
+			std::string name = content.substr(pos, equal - pos);
+			std::string value = content.substr(equal + 1, end - equal - 1);
+			if (name == "ServerIP")
+				serverIp = value;
+			else if (name == "Ports")
+				ports = value;
+			else if (name == "FreeGames")
+				freeGames = strtoul(value.c_str(), nullptr, 10);
+			else if (name == "Game")
+				games.push_back({ parseGamePort(value), value, {} });
+			else if (name == "Details" && !games.empty())
+				games.back().details = value;
+		}
+		pos = end + 1;
+	}
+}
+
+void NodeReport::writeGames(std::string& out) const
+{
+	for (const RemoteGame& game : games)
+		out += "Game=" + game.desc + "\n"
+				"Details=" + game.details + "\n";
+}
+
+void NodeReport::appendGames(std::string& content) const
+{
+	for (const RemoteGame& game : games)
+		content += game.desc + " GAMEDONE\n";
+}
+
+bool NodeReport::appendGameDetails(int port, std::string& content) const
+{
+	for (const RemoteGame& game : games)
+		if (game.port == port)
+		{
+			// No details until the next report for the games just created
+			content += (game.details.empty() ? game.desc : game.details) + "\nGAMEDONE\n";
+			return true;
+		}
+	return false;
+}
+
+void ClusterLobby::setNodes(const std::string& addresses)
+{
+	std::vector<Node> newNodes;
+	for (size_t pos = 0; pos < addresses.length();)
+	{
+		size_t end = addresses.find_first_of(" ,", pos);
+		if (end == std::string::npos)
+			end = addresses.length();
+		std::string address = addresses.substr(pos, end - pos);
+		pos = end + 1;
+		if (address.empty())
+			continue;
+		Node *node = findNode(address);
+		if (node != nullptr) {
+			newNodes.push_back(std::move(*node));
+			continue;
+		}
+		size_t colon = address.rfind(':');
+		std::error_code ec;
+		asio::ip::address ip;
+		if (colon != std::string::npos)
+			ip = asio::ip::make_address(address.substr(0, colon), ec);
+		int port = colon == std::string::npos ? 0 : atoi(&address[colon + 1]);
+		if (colon == std::string::npos || ec || port <= 0 || port > 65535) {
+			ERROR_LOG("Invalid relay node address: %s", address.c_str());
+			continue;
+		}
+		Node newNode;
+		newNode.address = address;
+		newNode.endpoint = asio::ip::tcp::endpoint(ip, port);
+		newNodes.push_back(std::move(newNode));
+	}
+	const bool wasEmpty = nodes.empty();
+	nodes = std::move(newNodes);
+	if (wasEmpty && !nodes.empty())
+	{
+		for (Node& node : nodes)
+			poll(node);
+		startPollTimer();
+	}
+}
+
+void ClusterLobby::startPollTimer()
+{
+	pollTimer.expires_after(PollInterval);
+	pollTimer.async_wait([this](const std::error_code& ec) {
+		if (ec || nodes.empty())
+			return;
+		for (Node& node : nodes)
+			poll(node);
+		startPollTimer();
+	});
+}
+
+void ClusterLobby::poll(Node& node)
+{
+	if (node.polling)
+		return;
+	node.polling = true;
+	httpRequest(io_context, node.endpoint, "GET", "/internal/node", {}, RequestTimeout,
+		[this, address = node.address](const std::error_code& ec, int status, const std::string& content)
+		{
+			// The node may have been removed by a configuration reload
+			Node *node = findNode(address);
+			if (node == nullptr)
+				return;
+			node->polling = false;
+			if (ec || status != Reply::ok)
+			{
+				if (node->up)
+				{
+					WARN_LOG("Relay node %s is down: %s", address.c_str(),
+							ec ? ec.message().c_str() : ("HTTP status " + std::to_string(status)).c_str());
+					node->up = false;
+				}
+				return;
+			}
+			node->report.parse(content);
+			node->lastReport = asio::chrono::steady_clock::now();
+			if (!node->up)
+			{
+				NOTICE_LOG("Relay node %s is up: server IP %s ports %s", address.c_str(),
+						node->report.serverIp.c_str(), node->report.ports.c_str());
+				node->up = true;
+			}
+		});
+}
+
+bool ClusterLobby::isUp(const Node& node) const {
+	return node.up && asio::chrono::steady_clock::now() - node.lastReport < NodeTimeout;
+}
+
+ClusterLobby::Node *ClusterLobby::findNode(const std::string& address)
+{
+	for (Node& node : nodes)
+		if (node.address == address)
+			return &node;
+	return nullptr;
+}
+
+void ClusterLobby::appendGames(std::string& content) const
+{
+	for (const Node& node : nodes)
+		if (isUp(node))
+			node.report.appendGames(content);
+}
+
+bool ClusterLobby::appendGameDetails(int port, std::string& content) const
+{
+	for (const Node& node : nodes)
+		if (isUp(node) && node.report.appendGameDetails(port, content))
+			return true;
+	return false;
+}
+
+bool ClusterLobby::createGame(size_t localFreeGames, const Request& request, Reply& reply)
+{
+	Node *best = nullptr;
+	for (Node& node : nodes)
+		if (isUp(node) && node.report.freeGames > localFreeGames
+				&& (best == nullptr || node.report.freeGames > best->report.freeGames))
+			best = &node;
+	if (best == nullptr)
+		return false;
+	// Until the next report
+	best->report.freeGames--;
+	forwarded++;
+	DEBUG_LOG("Creating game on relay node %s", best->address.c_str());
+	Reply::Sender sender = reply.defer();
+	httpRequest(io_context, best->endpoint, "POST", "/cgi-bin/AFODC/CGI/AFODCCGI", request.content, RequestTimeout,
+		[this, address = best->address, sender](const std::error_code& ec, int status, const std::string& content)
+		{
+			Reply reply;
+			Node *node = findNode(address);
+			if (ec || status != Reply::ok)
+			{
+				forwardErrors++;
+				WARN_LOG("Can't create game on relay node %s: %s", address.c_str(),
+						ec ? ec.message().c_str() : ("HTTP status " + std::to_string(status)).c_str());
+				if (node != nullptr)
+					node->report.freeGames = 0;
+				reply.setContent("END\n");
+				// The client gets an empty reply but the failure is counted
+				reply.countedStatus = ec ? Reply::bad_gateway : status;
+			}
+			else
+			{
+				// List the new game until the next report
+				int port = parseGamePort(content);
+				if (node != nullptr && port != -1 && content.find("\nCREATED\n") != std::string::npos)
+					node->report.games.push_back({ port, content.substr(0, content.find('\n')), {} });
+				reply.setContent(content);
+			}
+			sender(std::move(reply));
+		});
+	return true;
+}
+
+size_t ClusterLobby::getNodesUp() const
+{
+	size_t count = 0;
+	for (const Node& node : nodes)
+		if (isUp(node))
+			count++;
+	return count;
+}
+
+size_t ClusterLobby::getGameCount() const
+{
+	size_t count = 0;
+	for (const Node& node : nodes)
+		if (isUp(node))
+			count += node.report.games.size();
+	return count;
+}
@@ -0,0 +1,125 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "asio.h"
+#include "game.h"
+#include "http.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/// Writes the report of a node (/internal/node): its game server IP and ports,
+/// the number of games that can still be created and the description of its games.
+void writeNodeReport(std::string& out, const std::string& serverIp, uint16_t portMin, uint16_t portMax,
+		size_t freeGames, const std::vector<Game::Ptr>& games);
+
+/// Sets the IP addresses of the cluster lobbies allowed to read the report
+/// of this node, separated by spaces or commas
+void setLobbyAddresses(const std::string& addresses);
+/// Returns true if the address is loopback or one of the lobby addresses
+bool isLobbyAddress(asio::ip::address address);
+
+/// Report of a node, as parsed by the cluster lobby or received from the previous
+/// server process after a handover
+struct NodeReport
+{
+	struct RemoteGame
+	{
+		int port;
+		std::string desc;
+		std::string details;
+	};
+	std::string serverIp;
+	std::string ports;
+	size_t freeGames = 0;
+	std::vector<RemoteGame> games;
+
+	/// Parses a report written by writeNodeReport, replacing the current content
+	void parse(const std::string& content);
+	/// Appends the games to a report
+	void writeGames(std::string& out) const;
+	/// Appends the listing of the games to an AFODCCGI reply
+	void appendGames(std::string& content) const;
+	/// Appends the description of the game using this port. Returns false if not found.
+	bool appendGameDetails(int port, std::string& content) const;
+};
+
+/// Lobby of a cluster of servers.
+/// The lobby periodically polls the report of the relay nodes. It lists their games
+/// along with its own, and creates new games on the node with the most free capacity
+/// by forwarding the client request to it. The client then connects to the relay directly.
+/// Game details are looked up by port, so the port ranges of the nodes must not overlap.
+class ClusterLobby
+{
+public:
+	explicit ClusterLobby(asio::io_context& io_context)
+		: io_context(io_context), pollTimer(io_context) {}
+	ClusterLobby(const ClusterLobby&) = delete;
+	ClusterLobby& operator=(const ClusterLobby&) = delete;
+
+	/// Sets the HTTP addresses (IP:port) of the relay nodes, separated by spaces or commas.
+	/// The state of the nodes still in the list is kept.
+	void setNodes(const std::string& addresses);
+
+	/// Appends the listing of the relay games to an AFODCCGI reply
+	void appendGames(std::string& content) const;
+	/// Appends the description of the relay game using this port. Returns false if not found.
+	bool appendGameDetails(int port, std::string& content) const;
+	/// Forwards a game creation request to the relay with the most free games,
+	/// if it has more than localFreeGames. The reply is deferred until the relay answers.
+	/// Returns false if the game should be created locally.
+	bool createGame(size_t localFreeGames, const Request& request, Reply& reply);
+
+	size_t getNodesUp() const;
+	size_t getGameCount() const;
+	uint64_t getForwardedCount() const {
+		return forwarded;
+	}
+	uint64_t getForwardErrors() const {
+		return forwardErrors;
+	}
+
+	static constexpr asio::chrono::seconds PollInterval { 2 };
+	/// Nodes that haven't replied for this long aren't used
+	static constexpr asio::chrono::seconds NodeTimeout { 3 * PollInterval };
+	/// Timeout of the requests sent to the relays
+	static constexpr asio::chrono::milliseconds RequestTimeout { 2000 };
+
+private:
+	struct Node
+	{
+		std::string address;
+		asio::ip::tcp::endpoint endpoint;
+		bool polling = false;
+		bool up = false;
+		asio::chrono::steady_clock::time_point lastReport;
+		NodeReport report;
+	};
+
+	void startPollTimer();
+	void poll(Node& node);
+	bool isUp(const Node& node) const;
+	Node *findNode(const std::string& address);
+
+	asio::io_context& io_context;
+	asio::steady_timer pollTimer;
+	std::vector<Node> nodes;
+	uint64_t forwarded = 0;
+	uint64_t forwardErrors = 0;
+};
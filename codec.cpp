@@ -0,0 +1,84 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "codec.h"
+#include "log.h"
+#include "tomcrypt.h"
+
+std::vector<uint8_t> hexStringToBytes(const std::string &s)
+{
+	std::vector<uint8_t> v;
+	v.reserve(s.length() / 2);
+	for (std::size_t pos = 0; pos < s.length() - 1; pos += 2)
+	{
+		int n;
+		if (sscanf(&s[pos], "%02x", &n) != 1) {
+			ERROR_LOG("Invalid hex string %s", s.c_str());
+			v.clear();
+			break;
+		}
+		v.push_back(n);
+	}
+	return v;
+}
+
+std::string bytesToHexString(const uint8_t *data, size_t len)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	std::string s;
+	s.reserve(len * 2);
+	for (size_t i = 0; i < len; i++) {
+		s.push_back(digits[data[i] >> 4]);
+		s.push_back(digits[data[i] & 0xf]);
+	}
+	return s;
+}
+
+std::string decrypt(const std::string& hex, const unsigned char *key)
+{
+	std::vector<uint8_t> ciphered = hexStringToBytes(hex);
+	symmetric_key skey;
+	rc5_setup(key, 8, 0, &skey);
+	std::vector<uint8_t> plain;
+	plain.resize(ciphered.size());
+	for (size_t i = 0; i < ciphered.size(); i += 8)
+		rc5_ecb_decrypt(ciphered.data() + i, plain.data() + i, &skey);
+	rc5_done(&skey);
+	return std::string((char *)&plain[0], (char *)&plain[plain.size()]);
+}
+
+std::string descramble(const std::string& cs)
+{
+	std::vector<uint8_t> data = hexStringToBytes(cs);
+	std::string ps;
+	ps.reserve(data.size());
+	for (uint8_t c : data)
+		ps.push_back((char)~((c >> 5) | (c << 3)));
+	return ps;
+}
+
+std::string scramble(const std::string& ps)
+{
+	std::vector<uint8_t> data;
+	data.reserve(ps.size());
+	for (char c : ps)
+	{
+		uint8_t b = ~(uint8_t)c;
+		data.push_back((uint8_t)((b >> 3) | (b << 5)));
+	}
+	return bytesToHexString(data.data(), data.size());
+}
@@ -0,0 +1,35 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// Encoding of the lobby (AFODCCGI, Watch) and ranking CGI parameters
+
+std::vector<uint8_t> hexStringToBytes(const std::string &s);
+std::string bytesToHexString(const uint8_t *data, size_t len);
+
+/// Decrypts an hex-encoded RC5 ciphered string
+std::string decrypt(const std::string& hex, const unsigned char *key);
+
+/// Decodes an hex-encoded scrambled parameter
+std::string descramble(const std::string& cs);
+/// Inverse of descramble. Returns an hex-encoded string.
+std::string scramble(const std::string& ps);
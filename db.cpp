@@ -17,14 +17,37 @@
 */
 #include "db.h"
 #include "log.h"
+#include "stats.h"
 #include <sqlite3.h>
 #include <cstdio>
 #include <cstring>
 #include <stdexcept>
 #include <algorithm>
+#include <chrono>
+#include <vector>
 
 static sqlite3 *db;
 static std::string dbPath;
+static LatencyHistogram queryLatency;
+
+// Records the time spent in a database function
+class QueryTimer
+{
+public:
+	QueryTimer() : start(std::chrono::steady_clock::now()) {
+	}
+	~QueryTimer() {
+		queryLatency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - start).count());
+	}
+
+private:
+	std::chrono::steady_clock::time_point start;
+};
+
+const LatencyHistogram& getDbQueryLatency() {
+	return queryLatency;
+}
 
 static bool openDatabase()
 {
@@ -125,6 +148,7 @@ private:
 
 std::string getTop10Scores()
 {
+	QueryTimer timer;
 	if (!openDatabase())
 		return {};
 	try {
@@ -156,6 +180,7 @@ void registerNewScore(int score, const std::string& player, const std::string& a
 {
 	if (score == 0 || player.empty())
 		return;
+	QueryTimer timer;
 	if (!openDatabase())
 		return;
 	try {
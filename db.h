@@ -18,7 +18,11 @@
 #pragma once
 #include <string>
 
+class LatencyHistogram;
+
 void setDatabasePath(const std::string& databasePath);
 std::string getTop10Scores();
 void registerNewScore(int score, const std::string& player, const std::string& arcade, const std::string& city, const std::string& state);
 void registerNewDcScore(int score, const std::string& player);
+/// Latency of the above functions
+const LatencyHistogram& getDbQueryLatency();
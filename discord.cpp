@@ -18,98 +18,365 @@
 #include "discord.h"
 #include "log.h"
 #include <curl/curl.h>
-#include "json.hpp"
+#include "events.h"
 #include "game.h"
+#include "jsonstring.h"
 #include <atomic>
-#include <thread>
 #include <chrono>
+#include <deque>
+#include <unordered_map>
+#include <strings.h>
 
-static std::string DiscordWebhook;
-static std::atomic_int threadCount;
-
-using namespace nlohmann;
+// Replaced when the configuration is reloaded
+static std::shared_ptr<const std::string> DiscordWebhook = std::make_shared<std::string>();
 
 class Notif
 {
 public:
-	std::string to_json() const
-	{
-		json embeds;
-		embeds.push_back({
-			{ "author",
-				{
-					{ "name", "Alien Front Online" },
-					{ "icon_url", "https://dcnet.flyca.st/gamepic/afo.jpg" }
-				},
-			},
-			{ "title", embed.title },
-			{ "description", embed.text },
-			{ "color", 9118205 },
-		});
+	struct Embed
+	{
+		std::string title;
+		std::string text;
+	};
 
-		json j = {
-			{ "content", content },
-			{ "embeds", embeds },
-		};
-		return j.dump(4);
+	// Writes the webhook payload into the given buffer
+	void to_json(std::string& out) const
+	{
+		out.clear();
+		out += "{\"content\":\"";
+		appendJsonString(out, content);
+		out += "\",\"embeds\":[";
+		for (size_t i = 0; i < embeds.size(); i++)
+		{
+			if (i != 0)
+				out += ',';
+			out += "{\"author\":{\"name\":\"Alien Front Online\",\"icon_url\":\"https://dcnet.flyca.st/gamepic/afo.jpg\"},\"title\":\"";
+			appendJsonString(out, embeds[i].title);
+			out += "\",\"description\":\"";
+			appendJsonString(out, embeds[i].text);
+			out += "\",\"color\":9118205}";
+		}
+		out += "]}";
+	}
+
+	// Appends another notification to this one if the result fits in a single message
+	bool merge(const Notif& other)
+	{
+		if (embeds.size() + other.embeds.size() > MaxEmbeds
+				|| content.length() + other.content.length() + 1 > MaxContentLength)
+			return false;
+		content += "\n" + other.content;
+		embeds.insert(embeds.end(), other.embeds.begin(), other.embeds.end());
+		return true;
 	}
 
 	std::string content;
-	struct {
-		std::string title;
-		std::string text;
-	} embed;
+	std::vector<Embed> embeds;
+
+	// Discord message limits
+	static constexpr size_t MaxEmbeds = 10;
+	static constexpr size_t MaxContentLength = 2000;
 };
 
-static void postWebhook(Notif notif)
+// Posts notifications to the webhook with curl_multi driven by the event bus io_context.
+// Notifications are sent one at a time; those queued in the meantime are sent together.
+class WebhookClient
 {
-	CURL *curl = curl_easy_init();
-	if (curl == nullptr) {
-		ERROR_LOG("Can't create curl handle");
-		threadCount.fetch_sub(1);
-		return;
+public:
+	WebhookClient(asio::io_context& io_context)
+		: io_context(io_context), timer(io_context), retryTimer(io_context)
+	{
+		multi = curl_multi_init();
+		curl_multi_setopt(multi, CURLMOPT_SOCKETFUNCTION, socketCallback);
+		curl_multi_setopt(multi, CURLMOPT_SOCKETDATA, this);
+		curl_multi_setopt(multi, CURLMOPT_TIMERFUNCTION, timerCallback);
+		curl_multi_setopt(multi, CURLMOPT_TIMERDATA, this);
+		easy = curl_easy_init();
+		headers = curl_slist_append(NULL, "Content-Type: application/json");
 	}
-	CURLcode res;
-	curl_easy_setopt(curl, CURLOPT_URL, DiscordWebhook.c_str());
-	curl_easy_setopt(curl, CURLOPT_USERAGENT, "DCNet-DiscordWebhook");
-	curl_slist *headers = curl_slist_append(NULL, "Content-Type: application/json");
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 
-	std::string json = notif.to_json();
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json.c_str());
+	~WebhookClient()
+	{
+		if (inFlight)
+			curl_multi_remove_handle(multi, easy);
+		for (auto& [fd, socket] : sockets)
+		{
+			socket->what = 0;
+			socket->descriptor.release();
+		}
+		curl_multi_cleanup(multi);
+		curl_easy_cleanup(easy);
+		curl_slist_free_all(headers);
+	}
+
+	void post(Notif&& notif)
+	{
+		if (queue.size() >= MaxQueueSize) {
+			ERROR_LOG("Discord queue full: notification dropped");
+			return;
+		}
+		queue.push_back(std::move(notif));
+		depth++;
+		startNext();
+	}
 
-	res = curl_easy_perform(curl);
-	if (res != CURLE_OK) {
-		ERROR_LOG("curl error: %d", res);
+	int getDepth() const {
+		return depth.load(std::memory_order_relaxed);
 	}
-	else
+	int getInFlight() const {
+		return inFlight.load(std::memory_order_relaxed) ? 1 : 0;
+	}
+
+private:
+	struct Socket
+	{
+		Socket(asio::io_context& io_context, curl_socket_t fd)
+			: descriptor(io_context, fd) {}
+
+		asio::posix::stream_descriptor descriptor;
+		int what = 0;		// CURL_POLL_xxx flags requested by curl
+		int waiting = 0;	// CURL_POLL_xxx flags being waited for
+	};
+	using SocketPtr = std::shared_ptr<Socket>;
+
+	void startNext()
 	{
-		long code;
-		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
-		if (code < 200 || code >= 300)
-			ERROR_LOG("Discord error: %ld", code);
+		if (sending != 0 || queue.empty())
+			return;
+		Notif notif = std::move(queue.front());
+		queue.pop_front();
+		sending = 1;
+		while (!queue.empty() && notif.merge(queue.front())) {
+			queue.pop_front();
+			sending++;
+		}
+		notif.to_json(body);
+		attempt = 0;
+		perform();
 	}
-	curl_slist_free_all(headers);
-	curl_easy_cleanup(curl);
-	threadCount.fetch_sub(1);
-}
 
-static void discordNotif(const Notif& notif)
-{
-	if (DiscordWebhook.empty())
-		return;
-	if (threadCount.fetch_add(1) >= 5) {
-		threadCount.fetch_sub(1);
-		ERROR_LOG("Discord max thread count reached");
-		return;
+	void perform()
+	{
+		if (std::chrono::steady_clock::now() < notBefore)
+		{
+			retryTimer.expires_at(notBefore);
+			retryTimer.async_wait([this](const std::error_code& ec) {
+				if (!ec)
+					perform();
+			});
+			return;
+		}
+		std::shared_ptr<const std::string> url = std::atomic_load(&DiscordWebhook);
+		if (url->empty()) {
+			// disabled by a configuration reload
+			finished();
+			return;
+		}
+		curl_easy_reset(easy);
+		curl_easy_setopt(easy, CURLOPT_URL, url->c_str());
+		curl_easy_setopt(easy, CURLOPT_USERAGENT, "DCNet-DiscordWebhook");
+		curl_easy_setopt(easy, CURLOPT_HTTPHEADER, headers);
+		curl_easy_setopt(easy, CURLOPT_POSTFIELDS, body.c_str());
+		curl_easy_setopt(easy, CURLOPT_POSTFIELDSIZE, (long)body.length());
+		curl_easy_setopt(easy, CURLOPT_TIMEOUT, 30L);
+		curl_easy_setopt(easy, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(easy, CURLOPT_WRITEFUNCTION, discardBody);
+		curl_easy_setopt(easy, CURLOPT_HEADERFUNCTION, headerCallback);
+		curl_easy_setopt(easy, CURLOPT_HEADERDATA, this);
+		retryAfter = 0.0;
+		resetAfter = 0.0;
+		remaining = -1;
+		CURLMcode rc = curl_multi_add_handle(multi, easy);
+		if (rc != CURLM_OK) {
+			ERROR_LOG("curl_multi_add_handle failed: %s", curl_multi_strerror(rc));
+			finished();
+			return;
+		}
+		inFlight = true;
 	}
-	std::thread thread(postWebhook, notif);
-	thread.detach();
-}
+
+	void completed(CURLcode res)
+	{
+		curl_multi_remove_handle(multi, easy);
+		inFlight = false;
+		auto now = std::chrono::steady_clock::now();
+		double delay = 0.0;
+		bool retry = false;
+		if (res != CURLE_OK)
+		{
+			WARN_LOG("curl error: %s", curl_easy_strerror(res));
+			retry = true;
+		}
+		else
+		{
+			long code;
+			curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &code);
+			if (code == 429) {
+				WARN_LOG("Discord rate limit reached");
+				delay = retryAfter;
+				retry = true;
+			}
+			else if (code >= 500) {
+				WARN_LOG("Discord error: %ld", code);
+				retry = true;
+			}
+			else if (code < 200 || code >= 300) {
+				ERROR_LOG("Discord error: %ld", code);
+			}
+			if (remaining == 0)
+				// Bucket exhausted: hold the next post until it resets
+				notBefore = now + std::chrono::milliseconds((int)(resetAfter * 1000));
+		}
+		if (retry)
+		{
+			if (++attempt < MaxAttempts)
+			{
+				// exponential backoff, unless the server asked for longer
+				delay = std::max(delay, (double)(1 << (attempt - 1)));
+				notBefore = std::max(notBefore, now + std::chrono::milliseconds((int)(delay * 1000)));
+				INFO_LOG("Retrying Discord notification in %.1f s", delay);
+				perform();
+				return;
+			}
+			ERROR_LOG("Discord notification dropped after %d attempts", MaxAttempts);
+		}
+		finished();
+	}
+
+	void finished()
+	{
+		depth -= sending;
+		sending = 0;
+		startNext();
+	}
+
+	void socketAction(curl_socket_t fd, int events)
+	{
+		int running;
+		curl_multi_socket_action(multi, fd, events, &running);
+		CURLMsg *msg;
+		int pending;
+		while ((msg = curl_multi_info_read(multi, &pending)) != nullptr)
+			if (msg->msg == CURLMSG_DONE)
+				completed(msg->data.result);
+	}
+
+	void wait(const SocketPtr& socket, int direction)
+	{
+		if ((socket->what & direction) == 0 || (socket->waiting & direction) != 0)
+			return;
+		socket->waiting |= direction;
+		socket->descriptor.async_wait(direction == CURL_POLL_IN ? asio::posix::stream_descriptor::wait_read
+				: asio::posix::stream_descriptor::wait_write,
+			[this, socket, direction](const std::error_code& ec) {
+				socket->waiting &= ~direction;
+				if (ec || (socket->what & direction) == 0)
+					return;
+				socketAction(socket->descriptor.native_handle(), direction == CURL_POLL_IN ? CURL_CSELECT_IN : CURL_CSELECT_OUT);
+				wait(socket, direction);
+			});
+	}
+
+	static int socketCallback(CURL *, curl_socket_t fd, int what, void *userp, void *)
+	{
+		WebhookClient *client = (WebhookClient *)userp;
+		auto it = client->sockets.find(fd);
+		if (what == CURL_POLL_REMOVE)
+		{
+			if (it != client->sockets.end())
+			{
+				// curl owns the socket and will close it
+				it->second->what = 0;
+				it->second->descriptor.release();
+				client->sockets.erase(it);
+			}
+			return 0;
+		}
+		if (it == client->sockets.end())
+			it = client->sockets.emplace(fd, std::make_shared<Socket>(client->io_context, fd)).first;
+		SocketPtr socket = it->second;
+		socket->what = what;
+		client->wait(socket, CURL_POLL_IN);
+		client->wait(socket, CURL_POLL_OUT);
+		return 0;
+	}
+
+	static int timerCallback(CURLM *, long timeoutMs, void *userp)
+	{
+		WebhookClient *client = (WebhookClient *)userp;
+		if (timeoutMs < 0) {
+			client->timer.cancel();
+			return 0;
+		}
+		client->timer.expires_after(std::chrono::milliseconds(timeoutMs));
+		client->timer.async_wait([client](const std::error_code& ec) {
+			if (!ec)
+				client->socketAction(CURL_SOCKET_TIMEOUT, 0);
+		});
+		return 0;
+	}
+
+	static size_t discardBody(char *, size_t size, size_t nmemb, void *) {
+		return size * nmemb;
+	}
+
+	// Parses the rate limit headers of the response
+	static size_t headerCallback(char *buffer, size_t size, size_t nitems, void *userdata)
+	{
+		WebhookClient *client = (WebhookClient *)userdata;
+		size_t len = size * nitems;
+		std::string header(buffer, len);
+		size_t colon = header.find(':');
+		if (colon == std::string::npos)
+			return len;
+		std::string name = header.substr(0, colon);
+		double value = atof(header.c_str() + colon + 1);
+		if (!strcasecmp(name.c_str(), "retry-after"))
+			client->retryAfter = value;
+		else if (!strcasecmp(name.c_str(), "x-ratelimit-remaining"))
+			client->remaining = (int)value;
+		else if (!strcasecmp(name.c_str(), "x-ratelimit-reset-after"))
+			client->resetAfter = value;
+		return len;
+	}
+
+	asio::io_context& io_context;
+	asio::steady_timer timer;
+	asio::steady_timer retryTimer;
+	CURLM *multi;
+	CURL *easy;
+	curl_slist *headers;
+	std::unordered_map<curl_socket_t, SocketPtr> sockets;
+	std::deque<Notif> queue;
+	std::string body;	// payload being sent
+	int sending = 0;	// number of notifications in the payload
+	int attempt = 0;
+	std::atomic_bool inFlight { false };
+	std::atomic_int depth { 0 };	// notifications queued or being sent
+	double retryAfter = 0.0;
+	double resetAfter = 0.0;
+	int remaining = -1;
+	std::chrono::steady_clock::time_point notBefore;
+
+	static constexpr size_t MaxQueueSize = 32;
+	static constexpr int MaxAttempts = 4;
+};
+
+static std::atomic<WebhookClient *> webhookClient;
 
 void setDiscordWebhook(const std::string& url)
 {
-	DiscordWebhook = url;
+	std::atomic_store(&DiscordWebhook, std::make_shared<const std::string>(url));
+}
+
+int getDiscordQueueDepth() {
+	WebhookClient *client = webhookClient.load();
+	return client != nullptr ? client->getDepth() : 0;
+}
+
+int getDiscordInFlight() {
+	WebhookClient *client = webhookClient.load();
+	return client != nullptr ? client->getInFlight() : 0;
 }
 
 static std::string typeDesc(Game::GameType type)
@@ -137,7 +404,7 @@ static std::string escapeMarkdown(const std::string& s)
 	return ret;
 }
 
-void discordGameJoined(Game::GameType gameType, const std::string& gameName, const std::string& username,
+static void discordGameJoined(WebhookClient& client, Game::GameType gameType, const std::string& gameName, const std::string& username,
 		const std::vector<std::string>& playerList, int armySlots, int alienSlots)
 {
 	using the_clock = std::chrono::steady_clock;
@@ -148,21 +415,59 @@ void discordGameJoined(Game::GameType gameType, const std::string& gameName, con
 	last_notif = now;
 	Notif notif;
 	notif.content = "Player **" + escapeMarkdown(username) + "** joined " + typeDesc(gameType) + " game **" + escapeMarkdown(gameName) + "**";
-	notif.embed.title = "Players";
+	Notif::Embed embed;
+	embed.title = "Players";
 	for (const auto& player : playerList)
-		notif.embed.text += escapeMarkdown(player) + "\n";
-	notif.embed.text += "\n**Open slots**\n:military_helmet: "
+		embed.text += escapeMarkdown(player) + "\n";
+	embed.text += "\n**Open slots**\n:military_helmet: "
 			+ std::to_string(armySlots) + "\n:alien: " + std::to_string(alienSlots) + "\n";
-	discordNotif(notif);
+	notif.embeds.push_back(std::move(embed));
+	client.post(std::move(notif));
 }
 
-void discordGameCreated(Game::GameType gameType, const std::string& gameName, const std::string& username,
+static void discordGameCreated(WebhookClient& client, Game::GameType gameType, const std::string& gameName, const std::string& username,
 		int armySlots, int alienSlots)
 {
 	Notif notif;
 	notif.content = "Player **" + escapeMarkdown(username) + "** created " + typeDesc(gameType) + " game **" + escapeMarkdown(gameName) + "**";
-	notif.embed.title = "Players";
-	notif.embed.text += escapeMarkdown(username) + "\n\n**Open slots**\n:military_helmet: "
+	Notif::Embed embed;
+	embed.title = "Players";
+	embed.text = escapeMarkdown(username) + "\n\n**Open slots**\n:military_helmet: "
 			+ std::to_string(armySlots) + "\n:alien: " + std::to_string(alienSlots) + "\n";
-	discordNotif(notif);
+	notif.embeds.push_back(std::move(embed));
+	client.post(std::move(notif));
+}
+
+// Notifies the games created and joined
+class DiscordSink : public EventSink
+{
+public:
+	DiscordSink(asio::io_context& io_context)
+		: client(io_context)
+	{
+		webhookClient = &client;
+	}
+
+	~DiscordSink() override {
+		webhookClient = nullptr;
+	}
+
+	void publish(const GameEvent& event, const EventLine&) override
+	{
+		if (event.type != GameEvent::PlayerJoined || std::atomic_load(&DiscordWebhook)->empty())
+			return;
+		if (event.players.size() == 1)
+			discordGameCreated(client, event.gameType, event.gameName, event.player, event.armySlots, event.alienSlots);
+		else
+			discordGameJoined(client, event.gameType, event.gameName, event.player, event.players,
+					event.armySlots, event.alienSlots);
+	}
+
+private:
+	WebhookClient client;
+};
+
+std::unique_ptr<EventSink> createDiscordSink(asio::io_context& io_context)
+{
+	return std::make_unique<DiscordSink>(io_context);
 }
@@ -16,12 +16,17 @@
     along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 #pragma once
-#include "game.h"
+#include "asio.h"
+#include "events.h"
+#include <memory>
 #include <string>
-#include <vector>
 
+/// Can be called from any thread
 void setDiscordWebhook(const std::string& url);
-void discordGameCreated(Game::GameType gameType, const std::string& gameName, const std::string& username,
-		int armySlots, int alienSlots);
-void discordGameJoined(Game::GameType gameType, const std::string& gameName, const std::string& username,
-		const std::vector<std::string>& playerList, int armySlots, int alienSlots);
+/// Number of notifications queued or being sent
+int getDiscordQueueDepth();
+/// Number of webhook requests in progress
+int getDiscordInFlight();
+/// Creates the sink posting the games created and joined to the webhook.
+/// Notifications are ignored while no webhook is configured.
+std::unique_ptr<EventSink> createDiscordSink(asio::io_context& io_context);
@@ -0,0 +1,371 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "events.h"
+#include "jsonstring.h"
+#include "lobby.h"
+#include "player.h"
+#include "log.h"
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::string EventLogPath;
+static std::string EventSocketPath;
+
+GameEvent::GameEvent(Type type, const Game& game, const std::string& player, int slot)
+	: type(type), time(std::chrono::system_clock::now()), port(game.getIpPort()),
+	  gameName(game.getName()), gameType(game.getType()), player(player), slot(slot)
+{
+	for (int i = 0; i < 8; i++)
+	{
+		// The slot of a leaving player is reopened once the event has been published
+		if (game.getSlotType(i) == Game::Open || game.getSlotType(i) == Game::Open_CPU
+				|| (type == PlayerLeft && i == slot))
+		{
+			if (i >= 4)
+				alienSlots++;
+			else
+				armySlots++;
+		}
+		else if (game.getPlayer(i) != nullptr) {
+			players.push_back(game.getPlayer(i)->getName());
+		}
+	}
+}
+
+GameEvent::GameEvent(const std::string& player, int score)
+	: type(HighScore), time(std::chrono::system_clock::now()), player(player), score(score)
+{
+}
+
+const char *GameEvent::typeName() const
+{
+	switch (type)
+	{
+	case GameCreated: return "game_created";
+	case PlayerJoined: return "player_joined";
+	case PlayerLeft: return "player_left";
+	case GameTerminated: return "game_terminated";
+	case HighScore: return "high_score";
+	default: return "unknown";
+	}
+}
+
+void GameEvent::toJson(std::string& out) const
+{
+	out += "{\"event\":\"";
+	out += typeName();
+	out += "\",\"time\":";
+	out += std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count());
+	if (type == HighScore)
+	{
+		out += ",\"player\":\"";
+		appendJsonString(out, player);
+		out += "\",\"score\":";
+		out += std::to_string(score);
+	}
+	else
+	{
+		out += ",\"port\":";
+		out += std::to_string(port);
+		out += ",\"name\":\"";
+		appendJsonString(out, gameName);
+		out += "\",\"type\":\"";
+		out += gameTypeName(gameType);
+		out += '"';
+		if (!player.empty())
+		{
+			out += ",\"player\":\"";
+			appendJsonString(out, player);
+			out += "\",\"slot\":";
+			out += std::to_string(slot);
+		}
+		out += ",\"players\":[";
+		for (size_t i = 0; i < players.size(); i++)
+		{
+			if (i != 0)
+				out += ',';
+			out += '"';
+			appendJsonString(out, players[i]);
+			out += '"';
+		}
+		out += "],\"open_army_slots\":";
+		out += std::to_string(armySlots);
+		out += ",\"open_alien_slots\":";
+		out += std::to_string(alienSlots);
+	}
+	out += '}';
+}
+
+EventBus::EventBus()
+	: work(asio::make_work_guard(io_context)), head(&stub), tail(&stub)
+{
+}
+
+EventBus::~EventBus()
+{
+	work.reset();
+	if (thread.joinable())
+	{
+		// deliver the remaining events before stopping
+		asio::post(io_context, [this]() {
+			drain();
+			sinks.clear();
+		});
+		thread.join();
+	}
+	while (Node *node = pop())
+		delete node;
+}
+
+void EventBus::addSink(std::unique_ptr<EventSink>&& sink)
+{
+	if (sink != nullptr)
+		sinks.push_back(std::move(sink));
+}
+
+void EventBus::start()
+{
+	thread = std::thread([this]() {
+		io_context.run();
+	});
+}
+
+void EventBus::publish(GameEvent&& event)
+{
+	if (sinks.empty())
+		return;
+	push(new Node(std::move(event)));
+	if (!scheduled.exchange(true))
+		asio::post(io_context, [this]() { drain(); });
+}
+
+void EventBus::push(Node *node)
+{
+	node->next.store(nullptr, std::memory_order_relaxed);
+	Node *prev = head.exchange(node, std::memory_order_acq_rel);
+	prev->next.store(node, std::memory_order_release);
+}
+
+// Returns nullptr if the queue is empty or a producer hasn't finished pushing
+EventBus::Node *EventBus::pop()
+{
+	Node *node = tail;
+	Node *next = node->next.load(std::memory_order_acquire);
+	if (node == &stub)
+	{
+		if (next == nullptr)
+			return nullptr;
+		tail = next;
+		node = next;
+		next = next->next.load(std::memory_order_acquire);
+	}
+	if (next != nullptr) {
+		tail = next;
+		return node;
+	}
+	if (node != head.load(std::memory_order_acquire))
+		return nullptr;
+	push(&stub);
+	next = node->next.load(std::memory_order_acquire);
+	if (next != nullptr) {
+		tail = next;
+		return node;
+	}
+	return nullptr;
+}
+
+void EventBus::drain()
+{
+	// Events pushed from now on will schedule another drain
+	scheduled.store(false);
+	while (Node *node = pop())
+	{
+		auto line = std::make_shared<std::string>();
+		node->event.toJson(*line);
+		*line += '\n';
+		node->line = std::move(line);
+		for (auto& sink : sinks)
+			sink->publish(node->event, node->line);
+		delete node;
+	}
+}
+
+std::unique_ptr<JsonLinesSink> JsonLinesSink::open(const std::string& path)
+{
+	if (path.empty())
+		return nullptr;
+	FILE *file = fopen(path.c_str(), "a");
+	if (file == nullptr) {
+		ERROR_LOG("Can't open event log %s: %s", path.c_str(), strerror(errno));
+		return nullptr;
+	}
+	INFO_LOG("Logging game events to %s", path.c_str());
+	return std::unique_ptr<JsonLinesSink>(new JsonLinesSink(file));
+}
+
+JsonLinesSink::~JsonLinesSink() {
+	fclose(file);
+}
+
+void JsonLinesSink::publish(const GameEvent&, const EventLine& line)
+{
+	if (fwrite(line->data(), line->length(), 1, file) != 1 || fflush(file) != 0)
+		ERROR_LOG("Event log write failed: %s", strerror(errno));
+}
+
+class UnixSocketSink::Client : public std::enable_shared_from_this<Client>
+{
+public:
+	Client(asio::local::stream_protocol::socket&& socket)
+		: socket(std::move(socket)) {}
+
+	void send(const EventLine& line)
+	{
+		if (!isOpen())
+			return;
+		if (lines.size() >= MaxQueuedLines) {
+			WARN_LOG("Event socket client is too slow: disconnecting");
+			close();
+			return;
+		}
+		lines.push_back(line);
+		if (lines.size() == 1)
+			write();
+	}
+
+	void readUntilClosed()
+	{
+		socket.async_read_some(asio::buffer(readBuffer),
+			[self = shared_from_this()](const std::error_code& ec, size_t) {
+				if (ec)
+					self->close();
+				else
+					self->readUntilClosed();
+			});
+	}
+
+	bool isOpen() const {
+		return socket.is_open();
+	}
+
+	void close()
+	{
+		std::error_code ignored;
+		socket.close(ignored);
+	}
+
+private:
+	void write()
+	{
+		asio::async_write(socket, asio::buffer(*lines.front()),
+			[self = shared_from_this()](const std::error_code& ec, size_t) {
+				if (ec) {
+					self->close();
+					return;
+				}
+				self->lines.pop_front();
+				if (!self->lines.empty())
+					self->write();
+			});
+	}
+
+	asio::local::stream_protocol::socket socket;
+	std::deque<EventLine> lines;
+	char readBuffer[64];
+
+	static constexpr size_t MaxQueuedLines = 256;
+};
+
+std::unique_ptr<UnixSocketSink> UnixSocketSink::open(asio::io_context& io_context, const std::string& path)
+{
+	if (path.empty())
+		return nullptr;
+	unlink(path.c_str());
+	asio::local::stream_protocol::acceptor acceptor(io_context);
+	std::error_code ec;
+	acceptor.open(asio::local::stream_protocol(), ec);
+	if (!ec)
+		acceptor.bind(asio::local::stream_protocol::endpoint(path), ec);
+	if (!ec)
+		acceptor.listen(asio::socket_base::max_listen_connections, ec);
+	if (ec) {
+		ERROR_LOG("Can't create event socket %s: %s", path.c_str(), ec.message().c_str());
+		return nullptr;
+	}
+	INFO_LOG("Streaming game events to %s", path.c_str());
+	struct stat st {};
+	stat(path.c_str(), &st);
+	std::unique_ptr<UnixSocketSink> sink(new UnixSocketSink(std::move(acceptor), path, st.st_ino));
+	sink->accept();
+	return sink;
+}
+
+UnixSocketSink::~UnixSocketSink()
+{
+	std::error_code ignored;
+	acceptor.close(ignored);
+	for (auto& client : clients)
+		client->close();
+	// Don't delete the socket of a server that took over
+	struct stat st {};
+	if (stat(path.c_str(), &st) == 0 && st.st_ino == inode)
+		unlink(path.c_str());
+}
+
+void UnixSocketSink::accept()
+{
+	acceptor.async_accept(
+		[this](const std::error_code& ec, asio::local::stream_protocol::socket socket)
+		{
+			if (ec)
+				return;
+			auto client = std::make_shared<Client>(std::move(socket));
+			client->readUntilClosed();
+			clients.push_back(client);
+			accept();
+		});
+}
+
+void UnixSocketSink::publish(const GameEvent&, const EventLine& line)
+{
+	for (auto it = clients.begin(); it != clients.end(); )
+	{
+		(*it)->send(line);
+		if ((*it)->isOpen())
+			++it;
+		else
+			it = clients.erase(it);
+	}
+}
+
+void setEventLog(const std::string& path) {
+	EventLogPath = path;
+}
+
+void setEventSocket(const std::string& path) {
+	EventSocketPath = path;
+}
+
+void addConfiguredSinks(EventBus& bus)
+{
+	bus.addSink(JsonLinesSink::open(EventLogPath));
+	bus.addSink(UnixSocketSink::open(bus.getIoContext(), EventSocketPath));
+}
@@ -0,0 +1,166 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "asio.h"
+#include "game.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+class Player;
+
+/// Game lifecycle event. A copy of the game state is taken when the event
+/// is published so that sinks never access the game from their thread.
+struct GameEvent
+{
+	enum Type {
+		GameCreated,
+		PlayerJoined,
+		PlayerLeft,
+		GameTerminated,
+		HighScore,
+	};
+
+	GameEvent() = default;
+	/// Creates a lobby event. player is the player joining or leaving.
+	GameEvent(Type type, const Game& game, const std::string& player = {}, int slot = -1);
+	/// Creates a high score event
+	GameEvent(const std::string& player, int score);
+
+	const char *typeName() const;
+	/// Appends the JSON description of the event on a single line
+	void toJson(std::string& out) const;
+
+	Type type = GameCreated;
+	std::chrono::system_clock::time_point time;
+	uint16_t port = 0;
+	std::string gameName;
+	Game::GameType gameType = Game::None;
+	std::string player;
+	int slot = -1;
+	int score = 0;
+	std::vector<std::string> players;	// players in the game
+	int armySlots = 0;	// open army slots
+	int alienSlots = 0;	// open alien slots
+};
+
+/// JSON line of an event, serialized once and shared by all the sinks
+using EventLine = std::shared_ptr<const std::string>;
+
+/// Receives the events on the event bus thread
+class EventSink
+{
+public:
+	virtual ~EventSink() = default;
+	virtual void publish(const GameEvent& event, const EventLine& line) = 0;
+};
+
+/// Delivers game events to the sinks on a dedicated thread.
+/// Publishing only pushes the event on a lock-free queue so that
+/// slow consumers never delay the server io_context.
+class EventBus
+{
+public:
+	EventBus();
+	~EventBus();
+
+	/// Adds a sink. Ignored if null. Must be called before start().
+	void addSink(std::unique_ptr<EventSink>&& sink);
+	void start();
+	/// Can be called from any thread
+	void publish(GameEvent&& event);
+
+	/// The io_context run by the bus thread, for the sinks' async operations
+	asio::io_context& getIoContext() {
+		return io_context;
+	}
+
+private:
+	struct Node
+	{
+		Node() = default;
+		Node(GameEvent&& event) : event(std::move(event)) {}
+
+		std::atomic<Node *> next { nullptr };
+		GameEvent event;
+		EventLine line;
+	};
+
+	void push(Node *node);
+	Node *pop();
+	void drain();
+
+	asio::io_context io_context;
+	asio::executor_work_guard<asio::io_context::executor_type> work;
+	std::thread thread;
+	std::vector<std::unique_ptr<EventSink>> sinks;
+
+	// Vyukov intrusive MPSC queue
+	std::atomic<Node *> head;
+	Node *tail;	// consumer only
+	Node stub;
+	std::atomic_bool scheduled { false };
+};
+
+/// Appends each event as a JSON line to a file
+class JsonLinesSink : public EventSink
+{
+public:
+	/// Returns nullptr if path is empty or the file can't be opened
+	static std::unique_ptr<JsonLinesSink> open(const std::string& path);
+	~JsonLinesSink() override;
+
+	void publish(const GameEvent& event, const EventLine& line) override;
+
+private:
+	JsonLinesSink(FILE *file) : file(file) {}
+
+	FILE *file;
+};
+
+/// Streams the events as JSON lines to the clients connected to a UNIX socket
+class UnixSocketSink : public EventSink
+{
+public:
+	/// Returns nullptr if path is empty or the socket can't be created
+	static std::unique_ptr<UnixSocketSink> open(asio::io_context& io_context, const std::string& path);
+	~UnixSocketSink() override;
+
+	void publish(const GameEvent& event, const EventLine& line) override;
+
+private:
+	class Client;
+
+	UnixSocketSink(asio::local::stream_protocol::acceptor&& acceptor, const std::string& path, ino_t inode)
+		: acceptor(std::move(acceptor)), path(path), inode(inode) {}
+	void accept();
+
+	asio::local::stream_protocol::acceptor acceptor;
+	std::string path;
+	ino_t inode;
+	std::vector<std::shared_ptr<Client>> clients;
+};
+
+void setEventLog(const std::string& path);
+void setEventSocket(const std::string& path);
+/// Creates the file and socket sinks configured
+void addConfiguredSinks(EventBus& bus);
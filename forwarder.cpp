@@ -0,0 +1,438 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "forwarder.h"
+#include "log.h"
+#include <cerrno>
+#include <cstring>
+
+std::unique_ptr<KernelForwarder> KernelForwarder::Instance;
+
+#ifdef __linux__
+#include <linux/bpf.h>
+#include <linux/pkt_cls.h>
+#include <net/if.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef BPF_TCX_INGRESS
+// Linux 6.6
+#define BPF_TCX_INGRESS 46
+#endif
+#ifndef BPF_ATOMIC
+// Linux 5.12. Same opcode, an add with imm 0 is understood by older kernels too.
+#define BPF_ATOMIC BPF_XADD
+#endif
+
+static int bpf(int cmd, bpf_attr& attr) {
+	return syscall(__NR_bpf, cmd, &attr, sizeof(attr));
+}
+
+// Map key
+struct ForwardingKey
+{
+	uint32_t addr;	// source address, network byte order
+	uint16_t port;	// game UDP port, network byte order
+	uint16_t reserved;
+};
+
+// Minimal BPF assembler
+class BpfAssembler
+{
+public:
+	enum Size : uint8_t { B = BPF_B, H = BPF_H, W = BPF_W, DW = BPF_DW };
+
+	void mov(int dst, int src) { emit(BPF_ALU64 | BPF_MOV | BPF_X, dst, src, 0, 0); }
+	void movImm(int dst, int32_t imm) { emit(BPF_ALU64 | BPF_MOV | BPF_K, dst, 0, 0, imm); }
+	void addImm(int dst, int32_t imm) { emit(BPF_ALU64 | BPF_ADD | BPF_K, dst, 0, 0, imm); }
+	void andImm(int dst, int32_t imm) { emit(BPF_ALU64 | BPF_AND | BPF_K, dst, 0, 0, imm); }
+	void load(Size size, int dst, int src, int16_t off) { emit(BPF_LDX | size | BPF_MEM, dst, src, off, 0); }
+	void store(Size size, int dst, int16_t off, int src) { emit(BPF_STX | size | BPF_MEM, dst, src, off, 0); }
+	void storeImm(Size size, int dst, int16_t off, int32_t imm) { emit(BPF_ST | size | BPF_MEM, dst, 0, off, imm); }
+	void atomicAdd(int dst, int16_t off, int src) { emit(BPF_STX | BPF_DW | BPF_ATOMIC, dst, src, off, BPF_ADD); }
+	void jmp(int label) { jump(BPF_JMP | BPF_JA, 0, 0, 0, label); }
+	void jmpImm(uint8_t op, int dst, int32_t imm, int label) { jump(BPF_JMP | op | BPF_K, dst, 0, imm, label); }
+	void jmpReg(uint8_t op, int dst, int src, int label) { jump(BPF_JMP | op | BPF_X, dst, src, 0, label); }
+	void call(int32_t func) { emit(BPF_JMP | BPF_CALL, 0, 0, 0, func); }
+	void exit() { emit(BPF_JMP | BPF_EXIT, 0, 0, 0, 0); }
+	void loadMapFd(int dst, int fd) {
+		emit(BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, fd);
+		emit(0, 0, 0, 0, 0);
+	}
+
+	int newLabel() {
+		labels.push_back(-1);
+		return labels.size() - 1;
+	}
+	void setLabel(int label) {
+		labels[label] = insns.size();
+	}
+
+	const std::vector<bpf_insn>& assemble()
+	{
+		for (const auto& [index, label] : fixups)
+			insns[index].off = labels[label] - (index + 1);
+		return insns;
+	}
+
+private:
+	void emit(uint8_t code, int dst, int src, int16_t off, int32_t imm)
+	{
+		bpf_insn insn {};
+		insn.code = code;
+		insn.dst_reg = dst;
+		insn.src_reg = src;
+		insn.off = off;
+		insn.imm = imm;
+		insns.push_back(insn);
+	}
+	void jump(uint8_t code, int dst, int src, int32_t imm, int label) {
+		fixups.emplace_back(insns.size(), label);
+		emit(code, dst, src, 0, imm);
+	}
+
+	std::vector<bpf_insn> insns;
+	std::vector<int> labels;
+	std::vector<std::pair<size_t, int>> fixups;
+};
+
+// Packet offsets
+constexpr int16_t EthProto = 12;
+constexpr int16_t IpHeader = 14;
+constexpr int16_t IpFragment = IpHeader + 6;
+constexpr int16_t IpProtocol = IpHeader + 9;
+constexpr int16_t IpChecksum = IpHeader + 10;
+constexpr int16_t IpSource = IpHeader + 12;
+constexpr int16_t IpDest = IpHeader + 16;
+constexpr int16_t UdpSourcePort = IpHeader + 20;
+constexpr int16_t UdpDestPort = UdpSourcePort + 2;
+constexpr int16_t UdpChecksum = UdpSourcePort + 6;
+constexpr int16_t Opcode = UdpSourcePort + 8 + 2;
+static_assert(KernelForwarder::HeadersSize == UdpSourcePort + 8, "Wrong headers size");
+
+// Stack offsets
+constexpr int16_t StackKey = -8;
+constexpr int16_t StackOpcode = -16;
+constexpr int16_t StackNewAddr = -24;
+constexpr int16_t StackNewPort = -20;
+constexpr int16_t StackCurAddr = -32;
+constexpr int16_t StackCurPort = -28;
+constexpr int16_t StackIfIndex = -40;
+
+static std::vector<bpf_insn> buildProgram(int mapFd)
+{
+	using A = BpfAssembler;
+	constexpr int r0 = 0, r1 = 1, r2 = 2, r3 = 3, r4 = 4, r5 = 5, r6 = 6, r7 = 7, r8 = 8, r9 = 9, fp = 10;
+	const int16_t skbData = offsetof(__sk_buff, data);
+	const int16_t skbDataEnd = offsetof(__sk_buff, data_end);
+	const int16_t entryCount = offsetof(KernelForwarder::Entry, count);
+	const int16_t entryRecipients = offsetof(KernelForwarder::Entry, recipients);
+
+	A a;
+	const int pass = a.newLabel();
+	const int forward = a.newLabel();
+	const int done = a.newLabel();
+
+	a.mov(r6, r1);	// skb
+	// Only handle IPv4 UDP 0x78 and 0x03 packets without IP options or fragmentation
+	a.load(A::W, r2, r6, skbData);
+	a.load(A::W, r3, r6, skbDataEnd);
+	a.mov(r0, r2);
+	a.addImm(r0, Opcode + 1);
+	a.jmpReg(BPF_JGT, r0, r3, pass);
+	a.load(A::H, r0, r2, EthProto);
+	a.jmpImm(BPF_JNE, r0, htons(0x0800), pass);
+	a.load(A::B, r0, r2, IpHeader);
+	a.jmpImm(BPF_JNE, r0, 0x45, pass);
+	a.load(A::B, r0, r2, IpProtocol);
+	a.jmpImm(BPF_JNE, r0, 17, pass);
+	a.load(A::H, r0, r2, IpFragment);
+	a.andImm(r0, htons(0x3fff));
+	a.jmpImm(BPF_JNE, r0, 0, pass);
+	a.load(A::B, r0, r2, Opcode);
+	a.jmpImm(BPF_JEQ, r0, 0x78, forward);
+	a.jmpImm(BPF_JNE, r0, 0x03, pass);
+	a.setLabel(forward);
+	a.store(A::DW, fp, StackOpcode, r0);
+	// Look up the source address and game port
+	a.load(A::W, r0, r2, IpSource);
+	a.store(A::W, fp, StackKey, r0);
+	a.load(A::H, r0, r2, UdpDestPort);
+	a.store(A::H, fp, StackKey + 4, r0);
+	a.storeImm(A::H, fp, StackKey + 6, 0);
+	a.loadMapFd(r1, mapFd);
+	a.mov(r2, fp);
+	a.addImm(r2, StackKey);
+	a.call(BPF_FUNC_map_lookup_elem);
+	a.jmpImm(BPF_JEQ, r0, 0, pass);
+	a.mov(r9, r0);	// entry
+
+	// Packet pointers must be reloaded after a helper call
+	a.load(A::W, r7, r6, skbData);
+	a.load(A::W, r8, r6, skbDataEnd);
+	a.mov(r0, r7);
+	a.addImm(r0, Opcode + 1);
+	a.jmpReg(BPF_JGT, r0, r8, pass);
+	// Swap the MAC addresses: packets go back to the router they came from
+	a.load(A::W, r1, r7, 0);
+	a.load(A::H, r2, r7, 4);
+	a.load(A::W, r3, r7, 6);
+	a.load(A::H, r4, r7, 10);
+	a.store(A::W, r7, 0, r3);
+	a.store(A::H, r7, 4, r4);
+	a.store(A::W, r7, 6, r1);
+	a.store(A::H, r7, 10, r2);
+	// Swap the IP addresses and UDP ports. This doesn't change the checksums.
+	a.load(A::W, r1, r7, IpSource);
+	a.load(A::W, r2, r7, IpDest);
+	a.store(A::W, r7, IpSource, r2);
+	a.store(A::W, r7, IpDest, r1);
+	a.store(A::W, fp, StackCurAddr, r1);
+	a.load(A::H, r1, r7, UdpSourcePort);
+	a.load(A::H, r2, r7, UdpDestPort);
+	a.store(A::H, r7, UdpSourcePort, r2);
+	a.store(A::H, r7, UdpDestPort, r1);
+	a.store(A::H, fp, StackCurPort, r1);
+	a.load(A::W, r1, r6, offsetof(__sk_buff, ifindex));
+	a.store(A::W, fp, StackIfIndex, r1);
+
+	// Update the entry stats
+	const int op03 = a.newLabel();
+	const int statsDone = a.newLabel();
+	a.load(A::W, r1, r6, offsetof(__sk_buff, len));
+	a.atomicAdd(r9, offsetof(KernelForwarder::Entry, bytes), r1);
+	a.movImm(r1, 1);
+	a.load(A::DW, r2, fp, StackOpcode);
+	a.jmpImm(BPF_JNE, r2, 0x78, op03);
+	a.atomicAdd(r9, offsetof(KernelForwarder::Entry, packets78), r1);
+	a.jmp(statsDone);
+	a.setLabel(op03);
+	a.atomicAdd(r9, offsetof(KernelForwarder::Entry, packets03), r1);
+	a.setLabel(statsDone);
+	a.call(BPF_FUNC_ktime_get_ns);
+	a.store(A::DW, r9, offsetof(KernelForwarder::Entry, lastSeen), r0);
+
+	// Send a copy to each recipient
+	for (unsigned i = 0; i < KernelForwarder::MaxRecipients; i++)
+	{
+		a.load(A::W, r1, r9, entryCount);
+		a.jmpImm(BPF_JLE, r1, i, done);
+		a.load(A::W, r1, r9, entryRecipients + i * 8);
+		a.store(A::W, fp, StackNewAddr, r1);
+		a.load(A::H, r1, r9, entryRecipients + i * 8 + 4);
+		a.store(A::H, fp, StackNewPort, r1);
+		// Update the checksums
+		a.mov(r1, r6);
+		a.movImm(r2, IpChecksum);
+		a.load(A::W, r3, fp, StackCurAddr);
+		a.load(A::W, r4, fp, StackNewAddr);
+		a.movImm(r5, 4);
+		a.call(BPF_FUNC_l3_csum_replace);
+		a.mov(r1, r6);
+		a.movImm(r2, UdpChecksum);
+		a.load(A::W, r3, fp, StackCurAddr);
+		a.load(A::W, r4, fp, StackNewAddr);
+		a.movImm(r5, 4 | BPF_F_PSEUDO_HDR | BPF_F_MARK_MANGLED_0);
+		a.call(BPF_FUNC_l4_csum_replace);
+		a.mov(r1, r6);
+		a.movImm(r2, UdpChecksum);
+		a.load(A::H, r3, fp, StackCurPort);
+		a.load(A::H, r4, fp, StackNewPort);
+		a.movImm(r5, 2 | BPF_F_MARK_MANGLED_0);
+		a.call(BPF_FUNC_l4_csum_replace);
+		// Write the new destination
+		a.mov(r1, r6);
+		a.movImm(r2, IpDest);
+		a.mov(r3, fp);
+		a.addImm(r3, StackNewAddr);
+		a.movImm(r4, 4);
+		a.movImm(r5, 0);
+		a.call(BPF_FUNC_skb_store_bytes);
+		a.mov(r1, r6);
+		a.movImm(r2, UdpDestPort);
+		a.mov(r3, fp);
+		a.addImm(r3, StackNewPort);
+		a.movImm(r4, 2);
+		a.movImm(r5, 0);
+		a.call(BPF_FUNC_skb_store_bytes);
+		a.load(A::W, r1, fp, StackNewAddr);
+		a.store(A::W, fp, StackCurAddr, r1);
+		a.load(A::H, r1, fp, StackNewPort);
+		a.store(A::H, fp, StackCurPort, r1);
+		// Send to the interface egress
+		a.mov(r1, r6);
+		a.load(A::W, r2, fp, StackIfIndex);
+		a.movImm(r3, 0);
+		a.call(BPF_FUNC_clone_redirect);
+	}
+	a.setLabel(done);
+	a.movImm(r0, TC_ACT_SHOT);
+	a.exit();
+	a.setLabel(pass);
+	a.movImm(r0, TC_ACT_UNSPEC);
+	a.exit();
+
+	return a.assemble();
+}
+
+void KernelForwarder::init(const std::string& interface)
+{
+	if (interface.empty())
+		return;
+	unsigned ifindex = if_nametoindex(interface.c_str());
+	if (ifindex == 0) {
+		ERROR_LOG("Kernel forwarding: unknown interface %s", interface.c_str());
+		return;
+	}
+	bpf_attr attr {};
+	attr.map_type = BPF_MAP_TYPE_HASH;
+	attr.key_size = sizeof(ForwardingKey);
+	attr.value_size = sizeof(Entry);
+	attr.max_entries = 4096;
+	int mapFd = bpf(BPF_MAP_CREATE, attr);
+	if (mapFd < 0) {
+		ERROR_LOG("Kernel forwarding disabled: can't create BPF map: %s", strerror(errno));
+		return;
+	}
+	std::vector<bpf_insn> insns = buildProgram(mapFd);
+	std::vector<char> log(65536);
+	attr = {};
+	attr.prog_type = BPF_PROG_TYPE_SCHED_CLS;
+	attr.insns = (uintptr_t)insns.data();
+	attr.insn_cnt = insns.size();
+	attr.license = (uintptr_t)"GPL";
+	attr.log_buf = (uintptr_t)log.data();
+	attr.log_size = log.size();
+	attr.log_level = 1;
+	int progFd = bpf(BPF_PROG_LOAD, attr);
+	if (progFd < 0)
+	{
+		ERROR_LOG("Kernel forwarding disabled: can't load BPF program: %s", strerror(errno));
+		DEBUG_LOG("Verifier log: %s", log.data());
+		close(mapFd);
+		return;
+	}
+	attr = {};
+	attr.link_create.prog_fd = progFd;
+	attr.link_create.target_ifindex = ifindex;
+	attr.link_create.attach_type = BPF_TCX_INGRESS;
+	int linkFd = bpf(BPF_LINK_CREATE, attr);
+	if (linkFd < 0)
+	{
+		ERROR_LOG("Kernel forwarding disabled: can't attach BPF program to %s: %s", interface.c_str(), strerror(errno));
+		close(progFd);
+		close(mapFd);
+		return;
+	}
+	NOTICE_LOG("Kernel forwarding enabled on %s", interface.c_str());
+	Instance = std::unique_ptr<KernelForwarder>(new KernelForwarder(mapFd, progFd, linkFd));
+}
+
+KernelForwarder::~KernelForwarder()
+{
+	// Closing the link detaches the program
+	close(linkFd);
+	close(progFd);
+	close(mapFd);
+}
+
+static bool makeKey(const asio::ip::address& source, uint16_t udpPort, ForwardingKey& key)
+{
+	if (!source.is_v4())
+		return false;
+	auto bytes = source.to_v4().to_bytes();
+	memcpy(&key.addr, bytes.data(), 4);
+	key.port = htons(udpPort);
+	key.reserved = 0;
+	return true;
+}
+
+bool KernelForwarder::add(const asio::ip::address& source, uint16_t udpPort,
+		const std::vector<asio::ip::udp::endpoint>& recipients)
+{
+	ForwardingKey key;
+	if (!makeKey(source, udpPort, key) || recipients.size() > MaxRecipients)
+		return false;
+	Entry entry {};
+	for (const auto& endpoint : recipients)
+	{
+		if (!endpoint.address().is_v4())
+			return false;
+		auto bytes = endpoint.address().to_v4().to_bytes();
+		memcpy(&entry.recipients[entry.count].addr, bytes.data(), 4);
+		entry.recipients[entry.count].port = htons(endpoint.port());
+		entry.count++;
+	}
+	bpf_attr attr {};
+	attr.map_fd = mapFd;
+	attr.key = (uintptr_t)&key;
+	attr.value = (uintptr_t)&entry;
+	attr.flags = BPF_ANY;
+	if (bpf(BPF_MAP_UPDATE_ELEM, attr) < 0) {
+		WARN_LOG("Kernel forwarding: map update failed: %s", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+bool KernelForwarder::read(const asio::ip::address& source, uint16_t udpPort, Entry& entry) const
+{
+	ForwardingKey key;
+	if (!makeKey(source, udpPort, key))
+		return false;
+	bpf_attr attr {};
+	attr.map_fd = mapFd;
+	attr.key = (uintptr_t)&key;
+	attr.value = (uintptr_t)&entry;
+	return bpf(BPF_MAP_LOOKUP_ELEM, attr) == 0;
+}
+
+void KernelForwarder::remove(const asio::ip::address& source, uint16_t udpPort)
+{
+	ForwardingKey key;
+	if (!makeKey(source, udpPort, key))
+		return;
+	bpf_attr attr {};
+	attr.map_fd = mapFd;
+	attr.key = (uintptr_t)&key;
+	bpf(BPF_MAP_DELETE_ELEM, attr);
+}
+
+#else
+
+void KernelForwarder::init(const std::string& interface)
+{
+	if (!interface.empty())
+		ERROR_LOG("Kernel forwarding is only supported on Linux");
+}
+
+KernelForwarder::~KernelForwarder() {
+}
+
+bool KernelForwarder::add(const asio::ip::address& source, uint16_t udpPort,
+		const std::vector<asio::ip::udp::endpoint>& recipients) {
+	return false;
+}
+
+bool KernelForwarder::read(const asio::ip::address& source, uint16_t udpPort, Entry& entry) const {
+	return false;
+}
+
+void KernelForwarder::remove(const asio::ip::address& source, uint16_t udpPort) {
+}
+
+#endif
@@ -0,0 +1,84 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "asio.h"
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// Linux fast path for the UDP game traffic.
+/// A BPF program attached to the ingress of a network interface (tcx) forwards
+/// the 0x78 and 0x03 packets of the game players to the other players of the game,
+/// according to a forwarding map maintained by the games. Packets are cloned and
+/// redirected to the interface egress, and never reach the game socket.
+/// Everything else (pings, unknown sources, spectators...) goes through userspace.
+class KernelForwarder
+{
+public:
+	static constexpr unsigned MaxRecipients = 7;
+
+	/// Forwarding map value. Counters are updated by the BPF program.
+	struct Entry
+	{
+		uint32_t count;			// number of recipients
+		uint32_t reserved;
+		struct {
+			uint32_t addr;		// network byte order
+			uint16_t port;		// network byte order
+			uint16_t reserved;
+		} recipients[MaxRecipients];
+		uint64_t lastSeen;		// CLOCK_MONOTONIC time of the last packet in ns
+		uint64_t packets78;
+		uint64_t packets03;
+		uint64_t bytes;			// including ethernet, IP and UDP headers
+	};
+	static_assert(sizeof(Entry) == 96, "Unexpected Entry size");
+
+	/// Size of the ethernet, IP and UDP headers counted in Entry::bytes
+	static constexpr unsigned HeadersSize = 14 + 20 + 8;
+
+	/// Returns the kernel forwarder, or nullptr if it's disabled or unavailable
+	static KernelForwarder *instance() {
+		return Instance.get();
+	}
+	/// Attaches the BPF program to the specified interface.
+	/// Does nothing if the interface is empty. Logs an error if BPF isn't available.
+	static void init(const std::string& interface);
+
+	~KernelForwarder();
+
+	/// Forwards the packets received on the specified game UDP port from the source address.
+	/// Only IPv4 addresses are supported.
+	bool add(const asio::ip::address& source, uint16_t udpPort,
+			const std::vector<asio::ip::udp::endpoint>& recipients);
+	/// Reads the entry of the source address and port. Returns false if not found.
+	bool read(const asio::ip::address& source, uint16_t udpPort, Entry& entry) const;
+	void remove(const asio::ip::address& source, uint16_t udpPort);
+
+private:
+	KernelForwarder(int mapFd, int progFd, int linkFd)
+		: mapFd(mapFd), progFd(progFd), linkFd(linkFd) {
+	}
+
+	int mapFd;
+	int progFd;
+	int linkFd;
+
+	static std::unique_ptr<KernelForwarder> Instance;
+};
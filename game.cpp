@@ -17,24 +17,71 @@
 */
 #include "game.h"
 #include "player.h"
+#include <algorithm>
+#include <cerrno>
+#ifdef __linux__
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#endif
 
-Game::Game(Server& server, asio::io_context& io_context, const std::string& serverIp, uint16_t port)
-	: server(server), io_context(io_context), serverIp(serverIp), port(port),
-	  socket(io_context, asio::ip::udp::endpoint(asio::ip::address_v4(), port + 1)),
-	  pingTimer(io_context)
+static asio::chrono::milliseconds PingInterval { 1000 };
+static asio::chrono::seconds PlayerTimeout { 30 };
+static size_t MaxSpectators = 16;
+
+void setPingInterval(asio::chrono::milliseconds interval) {
+	PingInterval = interval;
+}
+
+asio::chrono::milliseconds getPingInterval() {
+	return PingInterval;
+}
+
+void setPlayerTimeout(asio::chrono::seconds timeout) {
+	PlayerTimeout = timeout;
+}
+
+void setMaxSpectators(int count)
+{
+	if (count < 0) {
+		ERROR_LOG("Invalid maximum number of spectators: %d", count);
+		return;
+	}
+	MaxSpectators = count;
+}
+
+Game::Game(Server& server, asio::io_context& io_context, const std::string& serverIp, uint16_t port,
+		int tcpFd, int udpFd)
+	: server(server), io_context(io_context), serverIp(serverIp), port(port), spectatorTimer(io_context), tcpFd(tcpFd),
+	  socket(udpFd >= 0 ? asio::ip::udp::socket(io_context, asio::ip::udp::v4(), udpFd)
+			: asio::ip::udp::socket(io_context, asio::ip::udp::endpoint(asio::ip::address_v4(), port + 1))),
+	  globalStats(RelayStats::local())
 {
 	asio::socket_base::reuse_address option(true);
 	socket.set_option(option);
+	asio::socket_base::send_buffer_size sendBuffer;
+	socket.get_option(sendBuffer);
+	sendBufferSize = sendBuffer.value();
+	memset(playerListPacket.data(), 0xfc, playerListPacket.size());
+	playerListPacket[0] = 0x85;
+	playerListPacket[1] = 0;
+	playerListPacket[2] = 1;
+	playerListPacket[3] = 1;
+	playerListPacket[4] = 0;	// player count
 }
 
 void Game::start()
 {
-	gameAcceptor = GameAcceptor::create(io_context, shared_from_this());
+	gameAcceptor = GameAcceptor::create(io_context, shared_from_this(), tcpFd);
+	tcpFd = -1;
 	gameAcceptor->start();
+	capture = PacketCapture::open(port);
+	if (capture != nullptr) {
+		std::string desc = getHttpDesc(false);
+		capture->write(PacketCapture::Info, PacketCapture::In, -1, 0, (const uint8_t *)desc.data(), desc.length());
+	}
 	udpRead();
-	// Initial timeout is 10 secs until the game creator connects
-	pingTimer.expires_at(asio::chrono::steady_clock::now() + asio::chrono::seconds(10));
-	pingTimer.async_wait(std::bind(&Game::onInitialTimeout, shared_from_this(), asio::placeholders::error));
+	startTime = asio::chrono::steady_clock::now();
 	NOTICE_LOG("Game %s [port %d] started", name.c_str(), port);
 }
 
@@ -84,8 +131,18 @@ std::string Game::getHttpDesc(bool attributes) const
 	return s;
 }
 
+int Game::getPlayerCount() const
+{
+	int count = 0;
+	for (const auto& slot : slots)
+		if (slot.player != nullptr)
+			count++;
+	return count;
+}
+
 int Game::assignSlot(Player::Ptr player, bool alien)
 {
+	stopKernelForwarding();
 	const size_t start = alien ? 4 : 0;
 	for (size_t i = start; i < start + 4; i++)
 	{
@@ -95,47 +152,38 @@ int Game::assignSlot(Player::Ptr player, bool alien)
 			slot.openType = slot.type;
 			slot.type = Filled;
 			slot.player = player;
-			slot.lastUdpReceive = asio::chrono::steady_clock::now();
-			if (pingSeq == 0)
-			{
-				// Start ping timer
-				pingSeq++;
-				pingTimer.expires_at(asio::chrono::steady_clock::now() + asio::chrono::seconds(1));
-				pingTimer.async_wait(std::bind(&Game::onPing, shared_from_this(), asio::placeholders::error));
-			}
+			slot.peer = { player->getUdpEndpoint(), player->getConnectionId() };
+			updatePlayerList(i);
+			lastUdpReceive[i] = CoarseClock::now();
+			server.playerJoined(*this, i);
+			// Start pinging
+			started = true;
 			return i;
 		}
 	}
 	return -1;
 }
 
-std::array<uint8_t, 0x82> Game::getPlayerList() const
+void Game::updatePlayerList(int slot)
 {
-	std::array<uint8_t, 0x82> pkt;
-	memset(pkt.data(), 0xfc, sizeof(pkt));
-	pkt[0] = 1;
-	uint8_t playerCount = 0;
-	size_t offset = 2;
-	for (auto& slot : slots)
+	// 0x85 packet header, then player count and 8 slot records of 16 bytes
+	uint8_t *record = &playerListPacket[5 + slot * 16];
+	const PlayerSlot& playerSlot = slots[slot];
+	if (playerSlot.player != nullptr)
 	{
-		if (slot.player != nullptr)
-		{
-			memset(&pkt[offset], 0, 16);
-			memcpy(&pkt[offset], &slot.player->getName()[0], slot.player->getName().length());
-			memcpy(&pkt[offset + 8], &slot.player->getExtraData()[0], 8);
-			playerCount++;
-		}
-		offset += 16;
+		const std::string& playerName = playerSlot.player->getName();
+		memset(record, 0, 8);
+		memcpy(record, playerName.data(), std::min<size_t>(playerName.length(), 8));
+		memcpy(record + 8, playerSlot.player->getExtraData().data(), 8);
 	}
-	pkt[1] = playerCount;
-	return pkt;
+	else {
+		memset(record, 0xfc, 16);
+	}
+	playerListPacket[4] = getPlayerCount();
 }
 
-void Game::sendPlayerList() const
-{
-	std::array<uint8_t, 0x85> pkt { 0x85, 0x00, 0x01 };
-	memcpy(&pkt[3], getPlayerList().data(), 0x82);
-	tcpSendToAll(pkt.data(), sizeof(pkt));
+void Game::sendPlayerList() const {
+	tcpSendToAll(playerListPacket.data(), playerListPacket.size());
 }
 
 void Game::udpRead()
@@ -150,56 +198,280 @@ void Game::udpRead()
 					ERROR_LOG("[port %d] UDP receive_from failed: %s", port, ec.message().c_str());
 				return;
 			}
-			//dump(recvbuf.data(), len);
-			Player::Ptr player;
-			for (auto& slot : slots)
-				if (slot.player != nullptr
-						&& slot.player->getUdpEndpoint().address() == source.address()) {
-					slot.lastUdpReceive = asio::chrono::steady_clock::now();
-					player = slot.player;
-					break;
-				}
-			// TODO alienfnt sends a ping every sec
-			//if (player == nullptr)
-			//{
-			//	for (const auto& spectator : spectators) {
-			//		slot.lastUdpReceive = asio::chrono::steady_clock::now();
-			//		break;
-			//	}
-			//}
-			if (player != nullptr)
+			udpReceived(recvbuf.data(), len, source);
+			udpRead();
+		});
+
+}
+
+void Game::udpReceived(const uint8_t *data, size_t len, const asio::ip::udp::endpoint& from)
+{
+	// Players are only referenced by slot index here. Their endpoints are copied in the slots,
+	// which avoids any shared_ptr copy (and atomic reference count update) per packet.
+	// Liveness uses the coarse clock and only one relayed packet in FanoutSampleInterval
+	// is timestamped for the stats.
+	int slotNum = -1;
+	for (int i = 0; i < 8; i++)
+	{
+		PlayerSlot& slot = slots[i];
+		if (slot.player != nullptr && slot.peer.endpoint.address() == from.address()) {
+			lastUdpReceive[i] = CoarseClock::now();
+			slotNum = i;
+			break;
+		}
+	}
+	capturePacket(PacketCapture::Udp, PacketCapture::In, slotNum,
+			slotNum != -1 ? slots[slotNum].peer.connectionId : 0, data, len);
+	// TODO alienfnt sends a ping every sec
+	//if (slotNum == -1)
+	//{
+	//	for (const auto& spectator : spectators) {
+	//		slot.lastUdpReceive = asio::chrono::steady_clock::now();
+	//		break;
+	//	}
+	//}
+	if (slotNum != -1)
+	{
+		const RelayStats::Opcode op = RelayStats::opcode(data[2]);
+		stats.packetsIn[op]++;
+		stats.bytesIn += len;
+		globalStats.packetsIn[op]++;
+		globalStats.bytesIn += len;
+		switch (data[2])
+		{
+		case 0x78:
+		case 0x03:
+			if (++fanoutSample % FanoutSampleInterval != 0) {
+				udpSendToAll(data, len, slotNum);
+			}
+			else
 			{
-				switch (recvbuf[2])
-				{
-				case 0x78:
-				case 0x03:
-					udpSendToAll(recvbuf.data(), len, player);
-					break;
-				case 0x00:
-					// ignore pings?
-					break;
-				default:
-					WARN_LOG("[port %d] UDP packet %02x not handled", port, recvbuf[2]);
-					break;
-				}
+				const auto start = asio::chrono::steady_clock::now();
+				udpSendToAll(data, len, slotNum);
+				const uint64_t latency = asio::chrono::duration_cast<asio::chrono::nanoseconds>(
+						asio::chrono::steady_clock::now() - start).count();
+				stats.fanoutLatency.record(latency);
+				globalStats.fanoutLatency.record(latency);
+			}
+			break;
+		case 0x00:
+			// ignore pings?
+			break;
+		default:
+			WARN_LOG("[port %d] UDP packet %02x not handled", port, data[2]);
+			break;
+		}
+	}
+	else
+	{
+		stats.unknownSource++;
+		globalStats.unknownSource++;
+		WARN_LOG("[port %d] UDP from unknown source: %s:%d", port, from.address().to_string().c_str(), from.port());
+	}
+}
+
+// Sends the same datagram to multiple endpoints with sendmmsg
+class UdpBatch
+{
+public:
+	/// If stopWhenBlocked is true, sending stops when the socket buffer is full
+	/// and the following endpoints are ignored.
+	UdpBatch(asio::ip::udp::socket& socket, const uint8_t *data, size_t len, bool stopWhenBlocked = false)
+		: socket(socket), data(data), len(len), stopWhenBlocked(stopWhenBlocked) {
+	}
+
+	void add(const asio::ip::udp::endpoint& endpoint)
+	{
+		if (blocked)
+			return;
+		if (count == endpoints.size())
+			flush();
+		endpoints[count++] = &endpoint;
+	}
+
+	void flush()
+	{
+		if (blocked)
+			return;
+#ifdef __linux__
+		iovec iov { (void *)data, len };
+		std::array<mmsghdr, MaxCount> msgs;
+		for (unsigned i = 0; i < count; i++)
+		{
+			msghdr& hdr = msgs[i].msg_hdr;
+			memset(&hdr, 0, sizeof(hdr));
+			hdr.msg_name = (void *)endpoints[i]->data();
+			hdr.msg_namelen = endpoints[i]->size();
+			hdr.msg_iov = &iov;
+			hdr.msg_iovlen = 1;
+		}
+		for (unsigned i = 0; i < count; )
+		{
+			int rc = sendmmsg(socket.native_handle(), &msgs[i], count - i, 0);
+			if (rc <= 0 && stopWhenBlocked && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+				blocked = true;
+				break;
+			}
+			if (rc <= 0) {
+				// skip the failed message
+				errors++;
+				i++;
 			}
 			else {
-				WARN_LOG("[port %d] UDP from unknown source: %s:%d", port, source.address().to_string().c_str(), source.port());
+				sent += rc;
+				i += rc;
 			}
-			udpRead();
-		});
+		}
+#else
+		std::error_code ec;
+		for (unsigned i = 0; i < count; i++)
+		{
+			socket.send_to(asio::buffer(data, len), *endpoints[i], 0, ec);
+			if (ec == asio::error::would_block && stopWhenBlocked) {
+				blocked = true;
+				break;
+			}
+			if (ec)
+				errors++;
+			else
+				sent++;
+		}
+#endif
+		count = 0;
+	}
 
-}
+	/// Number of endpoints sent to with a single system call
+	static constexpr unsigned MaxCount = 16;
+
+	unsigned sent = 0;
+	unsigned errors = 0;
+	/// The socket buffer was full. Endpoints after the first sent + errors ones weren't sent to.
+	bool blocked = false;
 
-void Game::udpSendToAll(const uint8_t *data, size_t len, const Player::Ptr& except)
+private:
+	asio::ip::udp::socket& socket;
+	const uint8_t *data;
+	size_t len;
+	bool stopWhenBlocked;
+	std::array<const asio::ip::udp::endpoint *, MaxCount> endpoints;
+	unsigned count = 0;
+};
+
+void Game::udpSendToAll(const uint8_t *data, size_t len, int exceptSlot)
 {
 	// TODO wait until we first receive something on UDP before sending?
-	std::error_code ec;
-	for (auto& slot : slots)
-		if (slot.player != nullptr && slot.player != except)
-			socket.send_to(asio::buffer(data, len), slot.player->getUdpEndpoint(), 0, ec);
-	for (const auto& spectator : spectators)
-		socket.send_to(asio::buffer(data, len), spectator->getUdpEndpoint(), 0, ec);
+	UdpBatch batch(socket, data, len);
+	for (int i = 0; i < 8; i++)
+	{
+		const PlayerSlot& slot = slots[i];
+		if (slot.player != nullptr && i != exceptSlot)
+		{
+			batch.add(slot.peer.endpoint);
+			capturePacket(PacketCapture::Udp, PacketCapture::Out, i, slot.peer.connectionId, data, len);
+		}
+	}
+	batch.flush();
+	const RelayStats::Opcode op = RelayStats::opcode(data[2]);
+	stats.packetsOut[op] += batch.sent;
+	stats.bytesOut += batch.sent * len;
+	stats.sendErrors += batch.errors;
+	globalStats.packetsOut[op] += batch.sent;
+	globalStats.bytesOut += batch.sent * len;
+	globalStats.sendErrors += batch.errors;
+	if (!spectatorPeers.empty())
+		queueForSpectators(data, len);
+}
+
+void Game::queueForSpectators(const uint8_t *data, size_t len)
+{
+	if (spectatorQueueCount == spectatorQueue.size())
+	{
+		// Drop the oldest packet
+		spectatorQueueHead = (spectatorQueueHead + 1) % spectatorQueue.size();
+		spectatorQueueCount--;
+		spectatorPeerIndex = 0;
+		stats.spectatorDrops++;
+		globalStats.spectatorDrops++;
+	}
+	SpectatorPacket& packet = spectatorQueue[(spectatorQueueHead + spectatorQueueCount) % spectatorQueue.size()];
+	packet.len = std::min(len, packet.data.size());
+	memcpy(packet.data.data(), data, packet.len);
+	spectatorQueueCount++;
+	if (!spectatorFlushPending)
+	{
+		// Send once the pending handlers, including player traffic, have run
+		spectatorFlushPending = true;
+		asio::post(io_context, std::bind(&Game::flushSpectatorQueue, shared_from_this()));
+	}
+}
+
+// Spectators only use half of the socket send buffer so that they can't make player packets fail
+bool Game::spectatorsCanSend()
+{
+#ifdef __linux__
+	int queued;
+	if (ioctl(socket.native_handle(), SIOCOUTQ, &queued) < 0)
+		return true;
+	return queued < sendBufferSize / 2;
+#else
+	return true;
+#endif
+}
+
+void Game::flushSpectatorQueue()
+{
+	spectatorFlushPending = false;
+	while (spectatorQueueCount > 0)
+	{
+		if (!spectatorsCanSend())
+		{
+			// Retry once the players' packets have gone out
+			spectatorFlushPending = true;
+			spectatorTimer.expires_after(SpectatorRetryDelay);
+			spectatorTimer.async_wait([game = shared_from_this()](const std::error_code& ec) {
+				if (!ec && game->socket.is_open())
+					game->flushSpectatorQueue();
+			});
+			return;
+		}
+		// One sendmmsg batch at a time so that the buffer usage is checked in between
+		const SpectatorPacket& packet = spectatorQueue[spectatorQueueHead];
+		UdpBatch batch(socket, packet.data.data(), packet.len, true);
+		const size_t batchEnd = std::min(spectatorPeers.size(), spectatorPeerIndex + UdpBatch::MaxCount);
+		for (size_t i = spectatorPeerIndex; i < batchEnd; i++)
+			batch.add(spectatorPeers[i].endpoint);
+		batch.flush();
+		const size_t end = std::min(spectatorPeers.size(), spectatorPeerIndex + batch.sent + batch.errors);
+		for (size_t i = spectatorPeerIndex; i < end; i++)
+			capturePacket(PacketCapture::Udp, PacketCapture::Out, -1, spectatorPeers[i].connectionId,
+					packet.data.data(), packet.len);
+		const RelayStats::Opcode op = RelayStats::opcode(packet.data[2]);
+		stats.packetsOut[op] += batch.sent;
+		stats.bytesOut += batch.sent * packet.len;
+		stats.sendErrors += batch.errors;
+		globalStats.packetsOut[op] += batch.sent;
+		globalStats.bytesOut += batch.sent * packet.len;
+		globalStats.sendErrors += batch.errors;
+		if (batch.blocked)
+		{
+			// Congestion: resume with the next spectator once the socket is writable.
+			// Meanwhile the oldest packets are dropped if the queue fills up.
+			spectatorPeerIndex = end;
+			spectatorFlushPending = true;
+			socket.async_wait(asio::socket_base::wait_write, [game = shared_from_this()](const std::error_code& ec) {
+				if (!ec)
+					game->flushSpectatorQueue();
+			});
+			return;
+		}
+		if (end < spectatorPeers.size()) {
+			spectatorPeerIndex = end;
+			continue;
+		}
+		spectatorPeerIndex = 0;
+		spectatorQueueHead = (spectatorQueueHead + 1) % spectatorQueue.size();
+		spectatorQueueCount--;
+	}
 }
 
 void Game::tcpSendToAll(const uint8_t *data, size_t len, const Player::Ptr& except) const
@@ -207,14 +479,18 @@ void Game::tcpSendToAll(const uint8_t *data, size_t len, const Player::Ptr& exce
 	for (auto& slot : slots)
 		if (slot.player != nullptr && slot.player != except)
 			slot.player->sendTcp(data, len);
-	for (const auto& spectator : spectators)
-		spectator->sendTcp(data, len);
+	if (!spectators.empty())
+	{
+		// Spectators are served after the players
+		asio::post(io_context, [game = shared_from_this(), packet = std::vector<uint8_t>(data, data + len)]() {
+			for (const auto& spectator : game->spectators)
+				spectator->sendTcp(packet.data(), packet.size());
+		});
+	}
 }
 
-void Game::onInitialTimeout(const std::error_code& ec)
+void Game::onInitialTimeout()
 {
-	if (ec)
-		return;
 	NOTICE_LOG("Game %s [port %d] timed out", name.c_str(), port);
 	if (gameAcceptor != nullptr) {
 		gameAcceptor->stop();
@@ -222,63 +498,190 @@ void Game::onInitialTimeout(const std::error_code& ec)
 	}
 	std::error_code ignored;
 	socket.close(ignored);
+	capture.reset();
 	server.deleteGame(shared_from_this());
 }
 
-void Game::onPing(const std::error_code& ec)
+void Game::updateKernelForwarding()
 {
-	if (ec)
+	KernelForwarder *forwarder = KernelForwarder::instance();
+	if (kernelForwarding || forwarder == nullptr)
+		return;
+	// Spectators and captures need the packets in userspace
+	if (capture != nullptr || !spectators.empty() || getPlayerCount() < 2) {
+		stableTicks = 0;
+		return;
+	}
+	for (const auto& slot : slots)
+		if (slot.player != nullptr && !slot.peer.endpoint.address().is_v4())
+			return;
+	if (++stableTicks < 2)
 		return;
-	uint8_t pkt[] { 0x0a, 0x00, 0x78, (uint8_t)(pingSeq & 0xff), (uint8_t)(pingSeq >> 8), 0x00, 0x00, 0x04, 0x08, 0x08 };
+	std::vector<asio::ip::udp::endpoint> recipients;
+	for (int i = 0; i < 8; i++)
+	{
+		if (slots[i].player == nullptr)
+			continue;
+		recipients.clear();
+		for (int j = 0; j < 8; j++)
+			if (j != i && slots[j].player != nullptr)
+				recipients.push_back(slots[j].peer.endpoint);
+		forwardedCounts[i] = {};
+		kernelForwarding = true;
+		if (!forwarder->add(slots[i].peer.endpoint.address(), port + 1, recipients)) {
+			stopKernelForwarding();
+			return;
+		}
+	}
+	INFO_LOG("[port %d] UDP forwarding handed over to the kernel", port);
+}
+
+void Game::readKernelForwardingStats()
+{
+	KernelForwarder *forwarder = KernelForwarder::instance();
+	for (int i = 0; i < 8; i++)
+	{
+		if (slots[i].player == nullptr)
+			continue;
+		KernelForwarder::Entry entry;
+		if (!forwarder->read(slots[i].peer.endpoint.address(), port + 1, entry))
+			continue;
+		ForwardedCounts& counts = forwardedCounts[i];
+		const uint64_t packets78 = entry.packets78 - counts.packets78;
+		const uint64_t packets03 = entry.packets03 - counts.packets03;
+		const uint64_t bytes = entry.bytes - counts.bytes - (packets78 + packets03) * KernelForwarder::HeadersSize;
+		counts = { entry.packets78, entry.packets03, entry.bytes };
+		for (RelayStats *s : { &stats, &globalStats })
+		{
+			s->packetsIn[RelayStats::Op78] += packets78;
+			s->packetsIn[RelayStats::Op03] += packets03;
+			s->bytesIn += bytes;
+			s->packetsOut[RelayStats::Op78] += packets78 * entry.count;
+			s->packetsOut[RelayStats::Op03] += packets03 * entry.count;
+			s->bytesOut += bytes * entry.count;
+		}
+		if (entry.lastSeen != 0)
+		{
+			// CLOCK_MONOTONIC
+			CoarseClock::time_point lastSeen(asio::chrono::duration_cast<asio::chrono::steady_clock::duration>(
+					asio::chrono::nanoseconds(entry.lastSeen)));
+			if (lastSeen > lastUdpReceive[i])
+				lastUdpReceive[i] = lastSeen;
+		}
+	}
+}
+
+void Game::stopKernelForwarding()
+{
+	stableTicks = 0;
+	if (!kernelForwarding)
+		return;
+	readKernelForwardingStats();
+	KernelForwarder *forwarder = KernelForwarder::instance();
+	for (int i = 0; i < 8; i++)
+		if (slots[i].player != nullptr)
+			forwarder->remove(slots[i].peer.endpoint.address(), port + 1);
+	kernelForwarding = false;
+	DEBUG_LOG("[port %d] UDP forwarding back in userspace", port);
+}
+
+void Game::tick(asio::chrono::steady_clock::time_point now)
+{
+	if (!started)
+	{
+		// Initial timeout is 10 secs until the game creator connects
+		if (now >= startTime + asio::chrono::seconds(10))
+			onInitialTimeout();
+		return;
+	}
+	pingPacket[3] = pingSeq & 0xff;
+	pingPacket[4] = pingSeq >> 8;
 	pingSeq++;
-	udpSendToAll(pkt, sizeof(pkt));
-	pingTimer.expires_at(asio::chrono::steady_clock::now() + asio::chrono::seconds(1));
-	pingTimer.async_wait(std::bind(&Game::onPing, shared_from_this(), asio::placeholders::error));
+	udpSendToAll(pingPacket.data(), pingPacket.size());
+	if (kernelForwarding)
+		// Updates the last receive times too
+		readKernelForwardingStats();
 	// Time out players
-	auto now = asio::chrono::steady_clock::now();
-	for (auto& slot : slots)
-		if (slot.player != nullptr && slot.lastUdpReceive + asio::chrono::seconds(30) <= now) {
-			INFO_LOG("[port %d] Player %s has timed out", port, slot.player->getName().c_str());
-			disconnect(slot.player);
+	for (int i = 0; i < 8; i++)
+		if (slots[i].player != nullptr && lastUdpReceive[i] + PlayerTimeout <= now) {
+			INFO_LOG("[port %d] Player %s has timed out", port, slots[i].player->getName().c_str());
+			disconnect(slots[i].player);
 		}
+	updateKernelForwarding();
 }
 
 void Game::disconnect(Player::Ptr player)
 {
+	stopKernelForwarding();
 	bool empty = true;
-	for (auto& slot : slots)
+	for (size_t i = 0; i < slots.size(); i++)
+	{
+		PlayerSlot& slot = slots[i];
 		if (slot.player == player)
 		{
 			INFO_LOG("[port %d] Player %s left game %s", port, slot.player->getName().c_str(), name.c_str());
+			server.playerLeft(*this, *slot.player, i);
 			slot.type = slot.openType;
 			slot.player->resetSlotNum();
 			slot.player->disconnect();
 			slot.player = nullptr;
+			updatePlayerList(i);
 		}
 		else if (slot.player != nullptr) {
 			empty = false;
 		}
+	}
 	if (!empty) {
 		sendPlayerList();
 		return;
 	}
-	NOTICE_LOG("Game %s [port %d] terminated", name.c_str(), port);
+	NOTICE_LOG("Game %s [port %d] terminated: UDP %lu packets in, %lu out, fan-out p50 %lu ns p99 %lu ns",
+			name.c_str(), port, stats.packetsIn[RelayStats::Op78] + stats.packetsIn[RelayStats::Op03],
+			stats.packetsOut[RelayStats::Op78] + stats.packetsOut[RelayStats::Op03],
+			stats.fanoutLatency.percentile(50), stats.fanoutLatency.percentile(99));
 	if (gameAcceptor != nullptr) {
 		gameAcceptor->stop();
 		gameAcceptor = nullptr;
 	}
 	std::error_code ec;
 	socket.close(ec);
+	capture.reset();
 	server.deleteGame(shared_from_this());
 }
 
-void Game::addSpectator(Player::Ptr player) {
+bool Game::addSpectator(Player::Ptr player)
+{
+	if (spectators.size() >= MaxSpectators)
+		return false;
+	stopKernelForwarding();
 	spectators.push_back(player);
+	spectatorPeers.push_back({ player->getUdpEndpoint(), player->getConnectionId() });
+	if (spectatorQueue.empty())
+		spectatorQueue.resize(SpectatorQueueSize);
+	server.spectatorsChanged(*this);
+	return true;
 }
 
-void Game::removeSpectator(Player::Ptr player) {
-	auto it = std::remove(spectators.begin(), spectators.end(), player);
-	spectators.erase(it, spectators.end());
+void Game::removeSpectator(Player::Ptr player)
+{
+	bool removed = false;
+	for (size_t i = 0; i < spectators.size(); )
+	{
+		if (spectators[i] == player)
+		{
+			spectators.erase(spectators.begin() + i);
+			spectatorPeers.erase(spectatorPeers.begin() + i);
+			// Keep the position of the next spectator to send the oldest packet to
+			if (i < spectatorPeerIndex)
+				spectatorPeerIndex--;
+			removed = true;
+		}
+		else {
+			i++;
+		}
+	}
+	if (removed)
+		server.spectatorsChanged(*this);
 }
 
 void GameAcceptor::start()
@@ -296,7 +699,7 @@ void GameAcceptor::handleAccept(GameConnection::Ptr newConnection, const std::er
 
 	if (!error)
 	{
-		Player::Ptr player = Player::create(newConnection, game);
+		Player::Ptr player = Player::create(newConnection, game, game->newConnectionId());
 		INFO_LOG("[port %d] New connection from %s", game->getIpPort(), newConnection->getSocket().remote_endpoint().address().to_string().c_str());
 		newConnection->setPlayer(player);
 		newConnection->start();
@@ -18,6 +18,9 @@
 #pragma once
 #include "shared_this.h"
 #include "asio.h"
+#include "capture.h"
+#include "stats.h"
+#include "forwarder.h"
 #include <array>
 #include <vector>
 #include <memory>
@@ -27,6 +30,32 @@ class GameAcceptor;
 class Server;
 class Player;
 
+/// Monotonic clock updated on each server tick.
+/// Reading it costs a load, at the expense of a resolution of one ping interval.
+class CoarseClock
+{
+public:
+	using time_point = asio::chrono::steady_clock::time_point;
+
+	static time_point now() {
+		return current;
+	}
+	static void update(time_point now) {
+		current = now;
+	}
+
+private:
+	static inline time_point current = asio::chrono::steady_clock::now();
+};
+
+/// Interval between the pings sent to players. Also the server tick interval.
+void setPingInterval(asio::chrono::milliseconds interval);
+asio::chrono::milliseconds getPingInterval();
+/// Players that haven't sent any UDP packet for this long are disconnected.
+void setPlayerTimeout(asio::chrono::seconds timeout);
+/// Maximum number of spectators per game. Negative values are ignored.
+void setMaxSpectators(int count);
+
 class Game : public SharedThis<Game>
 {
 public:
@@ -64,8 +93,21 @@ public:
 	void setSlots(const std::array<SlotType, 8>& slots);
 
 	std::shared_ptr<Player> getPlayer(int slot) const { return slots[slot].player; }
+	int getPlayerCount() const;
+	size_t getSpectatorCount() const { return spectators.size(); }
+
+	const RelayStats& getStats() const { return stats; }
+	/// Time elapsed since the last UDP packet was received from the player in the given slot
+	asio::chrono::steady_clock::duration getLastSeenAge(int slot) const {
+		return CoarseClock::now() - lastUdpReceive[slot];
+	}
 
 	std::string getHttpDesc(bool attributes) const;
+	/// Encoded player list packet (0x85). It is kept up to date when players
+	/// join, leave or update their extra data.
+	const std::array<uint8_t, 0x85>& getPlayerListPacket() const { return playerListPacket; }
+	/// Updates the player list record of the specified slot
+	void updatePlayerList(int slot);
 
 	int assignSlot(std::shared_ptr<Player> player, bool alien);
 
@@ -75,16 +117,42 @@ public:
 
 	void disconnect(std::shared_ptr<Player> player);
 
-	void addSpectator(std::shared_ptr<Player> player);
+	/// Returns false if the game has too many spectators
+	bool addSpectator(std::shared_ptr<Player> player);
 	void removeSpectator(std::shared_ptr<Player> player);
 
+	uint16_t newConnectionId() { return ++connectionCount; }
+
+	/// Called by the server every ping interval: sends pings and times out players
+	void tick(asio::chrono::steady_clock::time_point now);
+
+	/// Handles a UDP packet received from the specified endpoint
+	void udpReceived(const uint8_t *data, size_t len, const asio::ip::udp::endpoint& from);
+
+	void capturePacket(PacketCapture::Protocol protocol, PacketCapture::Direction direction, int slot,
+			unsigned connection, const uint8_t *data, size_t len) {
+		if (capture != nullptr)
+			capture->write(protocol, direction, slot, connection, data, len);
+	}
+	void captureTcp(PacketCapture::Direction direction, int slot, unsigned connection, uint8_t opcode,
+			const uint8_t *payload, size_t size) {
+		if (capture != nullptr)
+			capture->writeTcp(direction, slot, connection, opcode, payload, size);
+	}
+
 private:
-	Game(Server& server, asio::io_context& io_context, const std::string& serverIp, uint16_t port);
+	/// tcpFd and udpFd are pre-opened sockets for the port, or -1 to bind them
+	Game(Server& server, asio::io_context& io_context, const std::string& serverIp, uint16_t port,
+			int tcpFd = -1, int udpFd = -1);
 	void udpRead();
-	void onPing(const std::error_code& ec);
-	void udpSendToAll(const uint8_t *data, size_t len, const std::shared_ptr<Player>& except = nullptr);
-	std::array<uint8_t, 0x82> getPlayerList() const;
-	void onInitialTimeout(const std::error_code& ec);
+	void udpSendToAll(const uint8_t *data, size_t len, int exceptSlot = -1);
+	void onInitialTimeout();
+	void queueForSpectators(const uint8_t *data, size_t len);
+	void flushSpectatorQueue();
+	bool spectatorsCanSend();
+	void updateKernelForwarding();
+	void readKernelForwardingStats();
+	void stopKernelForwarding();
 
 	Server& server;
 	asio::io_context& io_context;
@@ -93,22 +161,72 @@ private:
 	uint16_t port;
 	GameType type {};
 	unsigned maps = 0;
+	// Copy of the player UDP endpoint and connection id so that the UDP relay
+	// doesn't need to touch Player objects.
+	struct UdpPeer
+	{
+		asio::ip::udp::endpoint endpoint;
+		uint16_t connectionId = 0;
+	};
 	struct PlayerSlot
 	{
 		SlotType type = Closed;
 		SlotType openType = Closed;	// to restore Open or Open/CPU when player leaves
 		std::shared_ptr<Player> player;
-		asio::chrono::time_point<asio::chrono::steady_clock> lastUdpReceive;
+		UdpPeer peer;
 	};
 	std::array<PlayerSlot, 8> slots;
+	// Kept apart from the slots so that timeouts are checked in a single cache line.
+	// Uses CoarseClock.
+	std::array<CoarseClock::time_point, 8> lastUdpReceive;
 	std::shared_ptr<GameAcceptor> gameAcceptor;
 	std::vector<std::shared_ptr<Player>> spectators;
+	std::vector<UdpPeer> spectatorPeers;	// same order as spectators
+	// UDP packets waiting to be sent to spectators. Spectators are served after the players
+	// and only use half of the socket send buffer, which is shared with the players.
+	// When it is used up, packets stay queued until it drains and the oldest ones are
+	// dropped when the queue is full.
+	struct SpectatorPacket
+	{
+		uint16_t len;
+		std::array<uint8_t, 1510> data;
+	};
+	std::vector<SpectatorPacket> spectatorQueue;	// ring buffer, allocated with the first spectator
+	size_t spectatorQueueHead = 0;
+	size_t spectatorQueueCount = 0;
+	size_t spectatorPeerIndex = 0;	// next spectator to send the oldest packet to, after congestion
+	bool spectatorFlushPending = false;
+	asio::steady_timer spectatorTimer;
+	static constexpr size_t SpectatorQueueSize = 32;
+	static constexpr asio::chrono::milliseconds SpectatorRetryDelay { 1 };
+	std::array<uint8_t, 0x85> playerListPacket;
+	int tcpFd;	// pre-opened listening socket passed to the acceptor
 	// UDP socket stuff
 	asio::ip::udp::socket socket;
+	int sendBufferSize = 0;
 	std::array<uint8_t, 1510> recvbuf;
 	asio::ip::udp::endpoint source;	// source endpoint when receiving UDP packets
-	asio::steady_timer pingTimer;
-	uint16_t pingSeq = 0;
+	asio::chrono::steady_clock::time_point startTime;
+	std::array<uint8_t, 10> pingPacket { 0x0a, 0x00, 0x78, 0x00, 0x00, 0x00, 0x00, 0x04, 0x08, 0x08 };
+	uint16_t pingSeq = 1;
+	// Set when the first player joins. Until then the game times out after a few seconds.
+	bool started = false;
+	// Kernel forwarding is enabled once the players haven't changed for a few ticks
+	bool kernelForwarding = false;
+	unsigned stableTicks = 0;
+	struct ForwardedCounts
+	{
+		uint64_t packets78 = 0;
+		uint64_t packets03 = 0;
+		uint64_t bytes = 0;
+	};
+	std::array<ForwardedCounts, 8> forwardedCounts;
+	std::unique_ptr<PacketCapture> capture;
+	RelayStats stats;
+	RelayStats& globalStats;
+	unsigned fanoutSample = 0;	// relayed packets, to time one in FanoutSampleInterval
+	static constexpr unsigned FanoutSampleInterval = 16;
+	uint16_t connectionCount = 0;
 
 	friend super;
 };
@@ -126,14 +244,13 @@ public:
 	}
 
 private:
-	GameAcceptor(asio::io_context& io_context, std::shared_ptr<Game> game)
+	GameAcceptor(asio::io_context& io_context, std::shared_ptr<Game> game, int listenFd)
 		: io_context(io_context),
-		  acceptor(asio::ip::tcp::acceptor(io_context,
-				asio::ip::tcp::endpoint(asio::ip::tcp::v4(), game->getIpPort()))),
+		  acceptor(listenFd >= 0 ? asio::ip::tcp::acceptor(io_context, asio::ip::tcp::v4(), listenFd)
+				: asio::ip::tcp::acceptor(io_context,
+					asio::ip::tcp::endpoint(asio::ip::tcp::v4(), game->getIpPort()), true)),
 				game(game)
 	{
-		asio::socket_base::reuse_address option(true);
-		acceptor.set_option(option);
 	}
 
 	void handleAccept(std::shared_ptr<GameConnection> newConnection, const std::error_code& error);
@@ -150,4 +267,10 @@ class Server
 public:
 	virtual ~Server() = default;
 	virtual void deleteGame(Game::Ptr game) = 0;
+	/// Called when a player has been assigned a slot in a game
+	virtual void playerJoined(const Game& game, int slot) {}
+	/// Called when a player leaves a game, before its slot is freed
+	virtual void playerLeft(const Game& game, const Player& player, int slot) {}
+	/// Called when a spectator joins or leaves a game
+	virtual void spectatorsChanged(const Game& game) {}
 };
@@ -0,0 +1,203 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "handover.h"
+#include "log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Message: magic, port count, idle port count, ports. The HTTP socket is attached with SCM_RIGHTS.
+// It is followed by the idle ports in chunks of at most IdleChunkPorts ports,
+// with their TCP and UDP sockets attached in this order.
+static constexpr uint32_t HandoverMagic = 0x41464f48;	// AFOH
+static constexpr unsigned MaxPorts = 1024;
+static constexpr unsigned MaxIdlePorts = 65536;
+static constexpr unsigned IdleChunkPorts = 100;	// the kernel passes up to 253 fds per message
+
+struct HandoverMessage
+{
+	uint32_t magic;
+	uint32_t portCount;
+	uint32_t idleCount;
+	uint16_t ports[MaxPorts];
+};
+static constexpr size_t HandoverHeaderSize = offsetof(HandoverMessage, ports);
+
+// Receives the chunks of idle port sockets. Returns false if the connection fails.
+static bool receiveIdlePorts(int fd, unsigned count, HandoverState& state)
+{
+	while (count > 0)
+	{
+		unsigned n = std::min(count, IdleChunkPorts);
+		uint16_t ports[IdleChunkPorts];
+		iovec iov { ports, n * sizeof(uint16_t) };
+		alignas(cmsghdr) char control[CMSG_SPACE(2 * IdleChunkPorts * sizeof(int))];
+		msghdr hdr {};
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = control;
+		hdr.msg_controllen = sizeof(control);
+		ssize_t len = recvmsg(fd, &hdr, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+		std::vector<int> fds;
+		for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			{
+				size_t fdCount = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+				fds.resize(fdCount);
+				memcpy(fds.data(), CMSG_DATA(cmsg), fdCount * sizeof(int));
+			}
+		if (len != (ssize_t)iov.iov_len || fds.size() != 2 * n || (hdr.msg_flags & MSG_CTRUNC))
+		{
+			for (int sock : fds)
+				close(sock);
+			return false;
+		}
+		for (unsigned i = 0; i < n; i++)
+		{
+			state.gameTcpFds[ports[i]] = fds[i * 2];
+			state.gameUdpFds[ports[i]] = fds[i * 2 + 1];
+		}
+		count -= n;
+	}
+	return true;
+}
+
+bool receiveHandover(const std::string& path, HandoverState& state)
+{
+	if (path.empty())
+		return false;
+	sockaddr_un addr {};
+	if (path.length() >= sizeof(addr.sun_path)) {
+		ERROR_LOG("Handover socket path too long: %s", path.c_str());
+		return false;
+	}
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		ERROR_LOG("Handover socket creation failed: %s", strerror(errno));
+		return false;
+	}
+	if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		// No server running
+		close(fd);
+		return false;
+	}
+	HandoverMessage msg;
+	iovec iov { &msg, sizeof(msg) };
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+	msghdr hdr {};
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = control;
+	hdr.msg_controllen = sizeof(control);
+	ssize_t len = recvmsg(fd, &hdr, MSG_CMSG_CLOEXEC);
+	int httpFd = -1;
+	for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&httpFd, CMSG_DATA(cmsg), sizeof(int));
+	if (len < (ssize_t)HandoverHeaderSize || msg.magic != HandoverMagic || msg.portCount > MaxPorts
+			|| msg.idleCount > MaxIdlePorts
+			|| (size_t)len != HandoverHeaderSize + msg.portCount * sizeof(uint16_t) || httpFd < 0)
+	{
+		ERROR_LOG("Invalid handover message from %s", path.c_str());
+		if (httpFd >= 0)
+			close(httpFd);
+		close(fd);
+		return false;
+	}
+	state.httpFd = httpFd;
+	state.connectionFd = fd;
+	state.busyPorts.assign(msg.ports, msg.ports + msg.portCount);
+	// The HTTP socket is already ours: without the idle sockets, the ports are bound again
+	// once the previous process has closed them
+	if (!receiveIdlePorts(fd, msg.idleCount, state)) {
+		ERROR_LOG("Idle game ports handover failed: %s", strerror(errno));
+		for (auto& [port, sock] : state.gameTcpFds)
+			close(sock);
+		for (auto& [port, sock] : state.gameUdpFds)
+			close(sock);
+		state.gameTcpFds.clear();
+		state.gameUdpFds.clear();
+	}
+	NOTICE_LOG("Took over from the previous server: %d game(s) still running, %zd idle port(s)",
+			msg.portCount, state.gameTcpFds.size());
+	return true;
+}
+
+bool sendHandover(int fd, const HandoverState& state)
+{
+	HandoverMessage msg;
+	msg.magic = HandoverMagic;
+	msg.portCount = std::min<size_t>(state.busyPorts.size(), MaxPorts);
+	std::copy(state.busyPorts.begin(), state.busyPorts.begin() + msg.portCount, msg.ports);
+	std::vector<uint16_t> idlePorts;
+	for (const auto& [port, tcpFd] : state.gameTcpFds)
+		if (state.gameUdpFds.count(port) != 0 && idlePorts.size() < MaxIdlePorts)
+			idlePorts.push_back(port);
+	msg.idleCount = idlePorts.size();
+	iovec iov { &msg, HandoverHeaderSize + msg.portCount * sizeof(uint16_t) };
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] {};
+	msghdr hdr {};
+	hdr.msg_iov = &iov;
+	hdr.msg_iovlen = 1;
+	hdr.msg_control = control;
+	hdr.msg_controllen = sizeof(control);
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &state.httpFd, sizeof(int));
+	if (sendmsg(fd, &hdr, MSG_NOSIGNAL) != (ssize_t)iov.iov_len) {
+		ERROR_LOG("Handover failed: %s", strerror(errno));
+		return false;
+	}
+	for (size_t i = 0; i < idlePorts.size(); i += IdleChunkPorts)
+	{
+		size_t n = std::min<size_t>(idlePorts.size() - i, IdleChunkPorts);
+		int fds[2 * IdleChunkPorts];
+		for (size_t j = 0; j < n; j++)
+		{
+			fds[j * 2] = state.gameTcpFds.at(idlePorts[i + j]);
+			fds[j * 2 + 1] = state.gameUdpFds.at(idlePorts[i + j]);
+		}
+		iovec chunkIov { &idlePorts[i], n * sizeof(uint16_t) };
+		alignas(cmsghdr) char chunkControl[CMSG_SPACE(2 * IdleChunkPorts * sizeof(int))] {};
+		msghdr chunkHdr {};
+		chunkHdr.msg_iov = &chunkIov;
+		chunkHdr.msg_iovlen = 1;
+		chunkHdr.msg_control = chunkControl;
+		chunkHdr.msg_controllen = CMSG_SPACE(2 * n * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&chunkHdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(2 * n * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, 2 * n * sizeof(int));
+		if (sendmsg(fd, &chunkHdr, MSG_NOSIGNAL) != (ssize_t)chunkIov.iov_len) {
+			// The new process has the HTTP socket: it binds the ports again instead
+			ERROR_LOG("Idle game ports handover failed: %s", strerror(errno));
+			break;
+		}
+	}
+	return true;
+}
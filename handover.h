@@ -0,0 +1,44 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Sockets and state passed by a running server to the process replacing it.
+/// The previous process keeps running its games until they end, and closes
+/// the handover connection when it exits. Meanwhile it sends the report of its games
+/// (see writeNodeReport) on the connection whenever they change, each prefixed with
+/// its 32-bit length, so that the new process lists them in its lobby.
+struct HandoverState
+{
+	int httpFd = -1;		// listening HTTP socket
+	int connectionFd = -1;	// handover connection to the previous process
+	std::vector<uint16_t> busyPorts;	// ports still used by the previous process
+	std::unordered_map<uint16_t, int> gameTcpFds;	// idle game port sockets by game port
+	std::unordered_map<uint16_t, int> gameUdpFds;
+};
+
+/// Connects to the server listening on the handover socket path and takes over its sockets.
+/// Returns false if no server is listening or the handover failed.
+bool receiveHandover(const std::string& path, HandoverState& state);
+/// Sends the listening HTTP socket, the ports in use and the sockets of the idle ports
+/// to the new process on the connection fd. connectionFd is ignored.
+/// Returns false if the HTTP socket couldn't be sent.
+bool sendHandover(int fd, const HandoverState& state);
@@ -0,0 +1,180 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+//
+// Local stand-in for a Discord webhook, to test the retries of the server notifications.
+// Set DiscordWebhook=http://127.0.0.1:9999/ in the server configuration. The first requests
+// are rejected with the status given, then the notifications are accepted.
+//
+#include "asio.h"
+#include <getopt.h>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <strings.h>
+
+using the_clock = asio::chrono::steady_clock;
+
+struct Options
+{
+	uint16_t port = 9999;
+	int status = 429;
+	int failures = 2;	// -1: always fail
+	double retryAfter = 1.0;
+};
+
+static Options options;
+static unsigned requestCount;
+static the_clock::time_point firstRequest;
+
+class Session : public std::enable_shared_from_this<Session>
+{
+public:
+	Session(asio::ip::tcp::socket&& socket)
+		: socket(std::move(socket)) {}
+
+	void readHeaders()
+	{
+		asio::async_read_until(socket, buffer, "\r\n\r\n",
+			[self = shared_from_this()](const std::error_code& ec, size_t size)
+			{
+				if (ec)
+					return;
+				std::string headers(asio::buffers_begin(self->buffer.data()), asio::buffers_begin(self->buffer.data()) + size);
+				self->buffer.consume(size);
+				size_t contentLength = 0;
+				for (size_t pos = headers.find("\r\n"); pos != std::string::npos; pos = headers.find("\r\n", pos + 2))
+				{
+					if (!strncasecmp(headers.c_str() + pos + 2, "Content-Length:", 15))
+						contentLength = strtoul(headers.c_str() + pos + 17, nullptr, 10);
+				}
+				self->requestLine = headers.substr(0, headers.find("\r\n"));
+				self->readBody(contentLength);
+			});
+	}
+
+private:
+	void readBody(size_t contentLength)
+	{
+		size_t missing = contentLength > buffer.size() ? contentLength - buffer.size() : 0;
+		asio::async_read(socket, buffer, asio::transfer_exactly(missing),
+			[self = shared_from_this(), contentLength](const std::error_code& ec, size_t)
+			{
+				if (ec)
+					return;
+				self->buffer.consume(contentLength);
+				self->reply(contentLength);
+			});
+	}
+
+	void reply(size_t contentLength)
+	{
+		the_clock::time_point now = the_clock::now();
+		if (requestCount++ == 0)
+			firstRequest = now;
+		bool fail = options.failures < 0 || (int)requestCount <= options.failures;
+		int status = fail ? options.status : 204;
+		printf("[%7.3fs] %s (%zu bytes) -> %d\n",
+				asio::chrono::duration_cast<asio::chrono::milliseconds>(now - firstRequest).count() / 1000.0,
+				requestLine.c_str(), contentLength, status);
+		fflush(stdout);
+
+		response = "HTTP/1.1 " + std::to_string(status) + (fail ? " Error" : " No Content") + "\r\n";
+		if (status == 429)
+		{
+			char retryAfter[32];
+			snprintf(retryAfter, sizeof(retryAfter), "%g", options.retryAfter);
+			response += "Retry-After: " + std::string(retryAfter) + "\r\n";
+		}
+		else if (!fail)
+			response += "X-RateLimit-Remaining: 5\r\nX-RateLimit-Reset-After: 1\r\n";
+		response += "Content-Length: 0\r\n\r\n";
+		asio::async_write(socket, asio::buffer(response),
+			[self = shared_from_this()](const std::error_code& ec, size_t) {
+				if (!ec)
+					self->readHeaders();
+			});
+	}
+
+	asio::ip::tcp::socket socket;
+	asio::streambuf buffer;
+	std::string requestLine;
+	std::string response;
+};
+
+static void accept(asio::ip::tcp::acceptor& acceptor)
+{
+	acceptor.async_accept([&acceptor](const std::error_code& ec, asio::ip::tcp::socket socket) {
+		if (ec)
+			return;
+		std::make_shared<Session>(std::move(socket))->readHeaders();
+		accept(acceptor);
+	});
+}
+
+static void usage(const char *progName)
+{
+	fprintf(stderr, "Usage: %s [options]\n", progName);
+	fprintf(stderr, "  -p  listening port on 127.0.0.1 (default 9999)\n");
+	fprintf(stderr, "  -s  HTTP status of the failed requests: 429 or 5xx (default 429)\n");
+	fprintf(stderr, "  -f  number of failed requests before accepting them, -1 to always fail (default 2)\n");
+	fprintf(stderr, "  -r  Retry-After value of the 429 replies in seconds (default 1)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "p:s:f:r:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'p': options.port = atoi(optarg); break;
+		case 's': options.status = atoi(optarg); break;
+		case 'f': options.failures = atoi(optarg); break;
+		case 'r': options.retryAfter = atof(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc || (options.status != 429 && (options.status < 500 || options.status > 599))) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	asio::io_context io_context;
+	asio::ip::tcp::acceptor acceptor(io_context);
+	std::error_code ec;
+	asio::ip::tcp::endpoint endpoint(asio::ip::address_v4::loopback(), options.port);
+	acceptor.open(endpoint.protocol(), ec);
+	if (!ec)
+		acceptor.set_option(asio::socket_base::reuse_address(true), ec);
+	if (!ec)
+		acceptor.bind(endpoint, ec);
+	if (!ec)
+		acceptor.listen(asio::socket_base::max_listen_connections, ec);
+	if (ec) {
+		fprintf(stderr, "Can't listen on port %d: %s\n", options.port, ec.message().c_str());
+		return 1;
+	}
+	printf("Webhook listening on http://127.0.0.1:%d/\n", options.port);
+	fflush(stdout);
+	accept(acceptor);
+	io_context.run();
+
+	return 0;
+}
@@ -111,7 +111,10 @@ std::vector<asio::const_buffer> Reply::toBuffers()
 		buffers.push_back(asio::buffer(misc_strings::crlf));
 	}
 	buffers.push_back(asio::buffer(misc_strings::crlf));
-	buffers.push_back(asio::buffer(content));
+	if (sharedContent != nullptr)
+		buffers.push_back(asio::buffer(*sharedContent));
+	else
+		buffers.push_back(asio::buffer(content));
 	return buffers;
 }
 
@@ -273,6 +276,41 @@ void Reply::setContent(const std::string& content, const std::string& mimeType)
 	status = ok;
 }
 
+void Reply::setContent(std::shared_ptr<const std::string> content, const std::string& mimeType)
+{
+	addHeader("Content-Length", std::to_string(content->size()));
+	addHeader("Content-Type", mimeType);
+	sharedContent = std::move(content);
+	status = ok;
+}
+
+Reply::Sender Reply::defer()
+{
+	deferred = true;
+	status = accepted;
+	return [connection = this->connection](Reply&& reply) {
+		Connection::Ptr conn = connection.lock();
+		if (conn != nullptr)
+			conn->sendReply(std::move(reply));
+	};
+}
+
+void Reply::setEventStream(EventSource& source)
+{
+	addHeader("Content-Type", "text/event-stream");
+	addHeader("Cache-Control", "no-cache");
+	eventSource = &source;
+	status = ok;
+}
+
+const std::string *Request::getHeader(const char *name) const
+{
+	for (const Header& header : headers)
+		if (!strcasecmp(header.name.c_str(), name))
+			return &header.value;
+	return nullptr;
+}
+
 void RequestHandler::handleRequest(const Request& req, Reply& rep)
 {
 	// Decode url to path.
@@ -291,20 +329,37 @@ void RequestHandler::handleRequest(const Request& req, Reply& rep)
 		return;
 	}
 
+	std::size_t qm_pos = request_path.find('?');
+	if (qm_pos == std::string::npos)
+		qm_pos = request_path.length();
 	// If path starts with /cgi-bin/ then call the corresponding handler
 	if (request_path.substr(0, 9) == "/cgi-bin/")
 	{
-		std::size_t qm_pos = request_path.find('?');
-		if (qm_pos == std::string::npos)
-			qm_pos = request_path.length();
 		auto it = cgiHandlers.find(request_path.substr(9, qm_pos - 9));
 		if (it != cgiHandlers.end()) {
-			it->second(req, rep);
+			handleRequest(it->first, it->second, req, rep);
+			return;
+		}
+	}
+	else
+	{
+		auto it = handlers.find(request_path.substr(0, qm_pos));
+		if (it != handlers.end()) {
+			handleRequest(it->first, it->second, req, rep);
 			return;
 		}
 	}
 	rep = Reply::stockReply(Reply::not_found);
-	return;
+	countRequest(std::string(), rep.status);
+}
+
+void RequestHandler::handleRequest(const std::string& path, const HttpHandler& handler, const Request& req, Reply& rep)
+{
+	handler(req, rep);
+	if (rep.deferred)
+		rep.handlerPath = path;
+	else
+		countRequest(path, rep.status);
 }
 
 bool RequestHandler::urlDecode(const std::string& in, std::string& out)
@@ -663,8 +718,15 @@ void Connection::doRead()
 
 				if (result == RequestParser::good)
 				{
+					reply.connection = self;
+					std::error_code ignored;
+					request.remoteAddress = socket.remote_endpoint(ignored).address();
 					requestHandler.handleRequest(request, reply);
+					if (reply.deferred)
+						return;
 					reply.addHeader("Connection", "close");
+					if (reply.eventSource != nullptr)
+						timeoutTimer.cancel();
 					doWrite();
 				}
 				else if (result == RequestParser::bad)
@@ -689,6 +751,11 @@ void Connection::doWrite()
 	asio::async_write(socket, reply.toBuffers(),
 		[this, self](std::error_code ec, std::size_t)
 		{
+			if (!ec && reply.eventSource != nullptr)
+			{
+				startEventStream();
+				return;
+			}
 			if (!ec)
 			{
 				if (!keepAlive)
@@ -713,6 +780,78 @@ void Connection::doWrite()
 		});
 }
 
+void Connection::sendReply(Reply&& reply)
+{
+	requestHandler.countRequest(this->reply.handlerPath, reply.countedStatus != 0 ? reply.countedStatus : reply.status);
+	this->reply = std::move(reply);
+	this->reply.addHeader("Connection", "close");
+	doWrite();
+}
+
+void Connection::stop()
+{
+	if (eventSource != nullptr)
+	{
+		EventSource *source = eventSource;
+		eventSource = nullptr;
+		source->unsubscribe(this);
+	}
+	socket.close();
+}
+
+void Connection::startEventStream()
+{
+	eventSource = reply.eventSource;
+	reply = {};
+	eventSource->subscribe(shared_from_this(), request.getHeader("Last-Event-ID"));
+	request = {};
+	doReadUntilClosed();
+}
+
+void Connection::doReadUntilClosed()
+{
+	auto self(shared_from_this());
+	socket.async_read_some(asio::buffer(buffer),
+		[this, self](std::error_code ec, std::size_t)
+		{
+			if (!ec)
+				doReadUntilClosed();
+			else if (ec != asio::error::operation_aborted)
+				connectionManager.stop(self);
+		});
+}
+
+void Connection::sendEvent(const std::shared_ptr<const std::string>& event)
+{
+	if (events.size() >= MAX_QUEUED_EVENTS)
+	{
+		// Slow subscriber
+		connectionManager.stop(shared_from_this());
+		return;
+	}
+	events.push_back(event);
+	if (events.size() == 1)
+		doWriteEvent();
+}
+
+void Connection::doWriteEvent()
+{
+	auto self(shared_from_this());
+	asio::async_write(socket, asio::buffer(*events.front()),
+		[this, self](std::error_code ec, std::size_t)
+		{
+			if (ec)
+			{
+				if (ec != asio::error::operation_aborted)
+					connectionManager.stop(self);
+				return;
+			}
+			events.pop_front();
+			if (!events.empty())
+				doWriteEvent();
+		});
+}
+
 void Connection::startTimer()
 {
 	timeoutTimer.expires_after(asio::chrono::seconds(30));
@@ -744,12 +883,90 @@ void ConnectionManager::stopAll()
 	connections.clear();
 }
 
-HttpServer::HttpServer(asio::io_context& io_context, const std::string& address, uint16_t port)
+EventSource::EventSource(asio::io_context& io_context)
+	: keepAliveTimer(io_context),
+	  keepAlive(std::make_shared<const std::string>(": keep-alive\n\n"))
+{
+	startKeepAliveTimer();
+}
+
+EventSource::~EventSource()
+{
+	for (const Connection::Ptr& connection : subscribers)
+		connection->eventSource = nullptr;
+}
+
+void EventSource::publish(const char *type, const std::string& data)
+{
+	lastId++;
+	std::string event;
+	event.reserve(data.length() + 48);
+	event += "id: ";
+	event += std::to_string(lastId);
+	event += "\nevent: ";
+	event += type;
+	event += "\ndata: ";
+	event += data;
+	event += "\n\n";
+	auto shared = std::make_shared<const std::string>(std::move(event));
+	history.emplace_back(lastId, shared);
+	if (history.size() > HISTORY_SIZE)
+		history.pop_front();
+	// sendEvent may unsubscribe slow connections
+	std::vector<Connection::Ptr> connections(subscribers.begin(), subscribers.end());
+	for (const Connection::Ptr& connection : connections)
+		connection->sendEvent(shared);
+}
+
+void EventSource::subscribe(Connection::Ptr connection, const std::string *lastEventId)
+{
+	subscribers.insert(connection);
+	if (lastEventId == nullptr)
+		return;
+	uint64_t id = strtoull(lastEventId->c_str(), nullptr, 10);
+	for (const auto& [eventId, event] : history)
+		if (eventId > id)
+			connection->sendEvent(event);
+}
+
+void EventSource::unsubscribe(Connection *connection)
+{
+	for (auto it = subscribers.begin(); it != subscribers.end(); ++it)
+		if (it->get() == connection) {
+			subscribers.erase(it);
+			break;
+		}
+}
+
+void EventSource::startKeepAliveTimer()
+{
+	keepAliveTimer.expires_after(asio::chrono::seconds(20));
+	keepAliveTimer.async_wait([this](const std::error_code& ec) {
+		if (ec)
+			return;
+		// Keeps proxies from closing idle connections and detects dead subscribers
+		std::vector<Connection::Ptr> connections(subscribers.begin(), subscribers.end());
+		for (const Connection::Ptr& connection : connections)
+			connection->sendEvent(keepAlive);
+		startKeepAliveTimer();
+	});
+}
+
+HttpServer::HttpServer(asio::io_context& io_context, const std::string& address, uint16_t port, int listenFd)
   : io_context(io_context),
     acceptor(io_context),
     connectionManager(),
     requestHandler()
 {
+	if (listenFd >= 0)
+	{
+		sockaddr_storage addr;
+		socklen_t addrLen = sizeof(addr);
+		getsockname(listenFd, (sockaddr *)&addr, &addrLen);
+		acceptor.assign(addr.ss_family == AF_INET6 ? asio::ip::tcp::v6() : asio::ip::tcp::v4(), listenFd);
+		doAccept();
+		return;
+	}
 	// Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
 	asio::ip::tcp::resolver resolver(io_context);
 	asio::ip::tcp::endpoint endpoint = *resolver.resolve(address, std::to_string(port)).begin();
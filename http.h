@@ -7,6 +7,8 @@
 #pragma once
 #include "asio.h"
 #include <array>
+#include <deque>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
@@ -29,8 +31,15 @@ struct Request
 	int http_version_minor;
 	std::vector<Header> headers;
 	std::string content;
+	asio::ip::address remoteAddress;
+
+	/// Returns the value of the specified header (case insensitive) or nullptr if not found
+	const std::string *getHeader(const char *name) const;
 };
 
+class EventSource;
+class Connection;
+
 /// A reply to be sent to a client.
 struct Reply
 {
@@ -54,7 +63,7 @@ struct Reply
 		not_implemented = 501,
 		bad_gateway = 502,
 		service_unavailable = 503
-	} status;
+	} status = internal_server_error;
 
 	/// The headers to be included in the reply.
 	std::vector<Header> headers;
@@ -62,6 +71,29 @@ struct Reply
 	/// The content to be sent in the reply.
 	std::string content;
 
+	/// Content shared between replies. Used instead of content if not null.
+	std::shared_ptr<const std::string> sharedContent;
+
+	/// If not null, the connection is kept open after the reply headers are sent
+	/// and subscribes to this event source.
+	EventSource *eventSource = nullptr;
+
+	/// True if the handler will send the reply later
+	bool deferred = false;
+	/// Path of the handler of a deferred reply, for the request counts
+	std::string handlerPath;
+	/// Status of a deferred reply in the request counts, if different from the reply status
+	int countedStatus = 0;
+
+	/// Connection the reply will be sent to
+	std::weak_ptr<Connection> connection;
+
+	/// Lets the handler send the reply later, once it is ready.
+	/// The returned function sends the reply, or does nothing if the connection has been closed.
+	/// Deferred replies are counted with the status of the reply eventually sent.
+	using Sender = std::function<void(Reply&&)>;
+	Sender defer();
+
 	/// Convert the reply into a vector of buffers. The buffers do not own the
 	/// underlying memory blocks, therefore the reply object must remain valid and
 	/// not be changed until the write operation has completed.
@@ -77,6 +109,10 @@ struct Reply
 
 	/// Sets the reply content and content type
 	void setContent(const std::string& content, const std::string& mimeType = "text/plain");
+	/// Sets the reply content to a shared immutable string, which avoids copying it
+	void setContent(std::shared_ptr<const std::string> content, const std::string& mimeType);
+	/// Turns the reply into a server-sent event stream fed by the specified event source
+	void setEventStream(EventSource& source);
 
 	/// Converts the reply into a string for logging purposes.
 	std::string to_string();
@@ -99,12 +135,33 @@ public:
 		cgiHandlers[path] = handler;
 	}
 
+	/// Adds a handler for the specified absolute path (/metrics for example).
+	void addHandler(const std::string& path, HttpHandler handler) {
+		handlers[path] = handler;
+	}
+
+	/// Number of handled requests by handler path and reply status.
+	/// Requests that don't match any handler are counted with an empty path.
+	using RequestCounts = std::map<std::pair<std::string, int>, uint64_t>;
+	const RequestCounts& getRequestCounts() const {
+		return requestCounts;
+	}
+	void countRequest(const std::string& path, int status) {
+		requestCounts[std::make_pair(path, status)]++;
+	}
+
 private:
-	std::unordered_map<std::string, HttpHandler> cgiHandlers;
+	void handleRequest(const std::string& path, const HttpHandler& handler, const Request& req, Reply& rep);
 
 	/// Perform URL-decoding on a string. Returns false if the encoding was
 	/// invalid.
 	static bool urlDecode(const std::string& in, std::string& out);
+
+	std::unordered_map<std::string, HttpHandler> cgiHandlers;
+	std::unordered_map<std::string, HttpHandler> handlers;
+	RequestCounts requestCounts;
+
+	friend class BenchAccess;
 };
 
 /// Parser for incoming requests.
@@ -224,12 +281,17 @@ public:
 	}
 
 	/// Stop all asynchronous operations associated with the connection.
-	void stop() {
-		socket.close();
-	}
+	void stop();
+
+	/// Sends a reply that was deferred by the request handler
+	void sendReply(Reply&& reply);
 
 	using Ptr = std::shared_ptr<Connection>;
 
+	/// Queues an event to be sent to an event stream subscriber.
+	/// The connection is closed if too many events are waiting to be sent.
+	void sendEvent(const std::shared_ptr<const std::string>& event);
+
 private:
 	/// Perform an asynchronous read operation.
 	void doRead();
@@ -239,6 +301,13 @@ private:
 
 	void startTimer();
 
+	/// Start streaming events after the reply headers have been sent
+	void startEventStream();
+	/// Wait for the event stream subscriber to close the connection
+	void doReadUntilClosed();
+	/// Send the next queued event
+	void doWriteEvent();
+
 	/// Socket for the connection.
 	asio::ip::tcp::socket socket;
 
@@ -263,6 +332,16 @@ private:
 	bool keepAlive = false;
 
 	asio::steady_timer timeoutTimer;
+
+	/// Event source this connection is subscribed to, if any.
+	EventSource *eventSource = nullptr;
+
+	/// Events waiting to be sent. The front one is being sent.
+	std::deque<std::shared_ptr<const std::string>> events;
+
+	static constexpr size_t MAX_QUEUED_EVENTS = 256;
+
+	friend class EventSource;
 };
 
 /// Manages open connections so that they may be cleanly stopped when the server
@@ -290,6 +369,42 @@ private:
 	std::set<Connection::Ptr> connections;
 };
 
+/// Server-sent events (text/event-stream) publisher.
+/// Each event is encoded once and the same buffer is sent to all subscribers.
+/// The last events are kept so that reconnecting clients sending a Last-Event-ID
+/// header don't miss any.
+class EventSource
+{
+public:
+	EventSource(const EventSource&) = delete;
+	EventSource& operator=(const EventSource&) = delete;
+
+	explicit EventSource(asio::io_context& io_context);
+	~EventSource();
+
+	/// Sends an event to all subscribers. data must not contain new lines.
+	void publish(const char *type, const std::string& data);
+
+	size_t getSubscriberCount() const {
+		return subscribers.size();
+	}
+
+private:
+	void subscribe(Connection::Ptr connection, const std::string *lastEventId);
+	void unsubscribe(Connection *connection);
+	void startKeepAliveTimer();
+
+	std::set<Connection::Ptr> subscribers;
+	std::deque<std::pair<uint64_t, std::shared_ptr<const std::string>>> history;
+	uint64_t lastId = 0;
+	asio::steady_timer keepAliveTimer;
+	std::shared_ptr<const std::string> keepAlive;
+
+	static constexpr size_t HISTORY_SIZE = 64;
+
+	friend class Connection;
+};
+
 class HttpServer
 {
 public:
@@ -297,13 +412,34 @@ public:
 	HttpServer& operator=(const HttpServer&) = delete;
 
 	/// Construct the server to listen on the specified TCP address and port.
-	explicit HttpServer(asio::io_context& io_context, const std::string& address, uint16_t port);
+	/// If listenFd isn't negative, the server uses this listening socket instead.
+	explicit HttpServer(asio::io_context& io_context, const std::string& address, uint16_t port, int listenFd = -1);
+
+	/// Stops accepting new connections. Live connections aren't closed.
+	void stop() {
+		std::error_code ec;
+		acceptor.close(ec);
+	}
+
+	/// Native handle of the listening socket
+	int getListenFd() {
+		return acceptor.native_handle();
+	}
 
 	/// Adds a cgi handler to the request handler. See RequestHandler::addCgiHandler
 	void addCgiHandler(const std::string& path, RequestHandler::HttpHandler handler) {
 		requestHandler.addCgiHandler(path, handler);
 	}
 
+	/// Adds a handler to the request handler. See RequestHandler::addHandler
+	void addHandler(const std::string& path, RequestHandler::HttpHandler handler) {
+		requestHandler.addHandler(path, handler);
+	}
+
+	const RequestHandler::RequestCounts& getRequestCounts() const {
+		return requestHandler.getRequestCounts();
+	}
+
 private:
 	/// Perform an asynchronous accept operation.
 	void doAccept();
@@ -0,0 +1,72 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "jsonstring.h"
+#include <stdint.h>
+
+void appendJsonString(std::string& out, const std::string& s)
+{
+	static const char hex[] = "0123456789abcdef";
+	for (size_t i = 0; i < s.length(); i++)
+	{
+		uint8_t c = s[i];
+		if (c >= 0x80)
+		{
+			size_t len = c >= 0xc2 && c <= 0xdf ? 2 : c >= 0xe0 && c <= 0xef ? 3 : c >= 0xf0 && c <= 0xf4 ? 4 : 0;
+			// The second byte range excludes overlong forms, surrogates and code points above U+10FFFF
+			uint8_t low = c == 0xe0 ? 0xa0 : c == 0xf0 ? 0x90 : 0x80;
+			uint8_t high = c == 0xed ? 0x9f : c == 0xf4 ? 0x8f : 0xbf;
+			size_t n = 1;
+			while (n < len && i + n < s.length())
+			{
+				uint8_t b = s[i + n];
+				if (b < low || b > high)
+					break;
+				low = 0x80;
+				high = 0xbf;
+				n++;
+			}
+			if (len == 0 || n != len) {
+				out += "\\ufffd";
+				i += n - 1;
+			}
+			else {
+				out.append(s, i, len);
+				i += len - 1;
+			}
+			continue;
+		}
+		switch (c)
+		{
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (c < 0x20) {
+				out += "\\u00";
+				out += hex[c >> 4];
+				out += hex[c & 0xf];
+			}
+			else {
+				out += (char)c;
+			}
+			break;
+		}
+	}
+}
@@ -0,0 +1,391 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+//
+// Synthetic load generator for the lobby and game protocols.
+// Lobby pollers continuously list the games while simulated matches are created, joined
+// and stream UDP game packets to each other through the server.
+//
+#include "asio.h"
+#include "client.h"
+#include <getopt.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using the_clock = asio::chrono::steady_clock;
+
+struct Stats : ClientStats
+{
+	uint64_t lobbyRequests = 0;
+	uint64_t lobbyErrors = 0;
+	unsigned playersLoggedIn = 0;
+	uint64_t udpBytesReceived = 0;
+	uint64_t pingsReceived = 0;
+};
+
+struct Options
+{
+	asio::ip::tcp::endpoint httpServer;
+	unsigned games = 10;
+	unsigned playersPerGame = 8;
+	unsigned packetRate = 30;
+	unsigned packetSize = 64;
+	unsigned lobbyPollers = 4;
+	unsigned duration = 30;
+};
+
+// UDP game packets: length (2 bytes), opcode 0x78 or 0x03, sender slot, sequence number and send time
+#pragma pack(push, 1)
+struct UdpPacket
+{
+	uint16_t length;
+	uint8_t opcode;
+	uint8_t sender;
+	uint32_t sequence;
+	int64_t sendTime;	// nanoseconds
+};
+#pragma pack(pop)
+
+static int64_t nanoTime() {
+	return asio::chrono::duration_cast<asio::chrono::nanoseconds>(the_clock::now().time_since_epoch()).count();
+}
+
+class LobbyPoller : public std::enable_shared_from_this<LobbyPoller>
+{
+public:
+	LobbyPoller(asio::io_context& io_context, const asio::ip::tcp::endpoint& server, Stats& stats)
+		: io_context(io_context), server(server), stats(stats), request(listGamesRequest()) {
+	}
+
+	void start()
+	{
+		httpPost(io_context, server, "AFODC/CGI/AFODCCGI", request,
+			[self = shared_from_this()](const std::error_code& ec, int status, const std::string& content)
+			{
+				if (self->stopped)
+					return;
+				if (ec || status != 200 || content.find("END\n") == std::string::npos)
+					self->stats.lobbyErrors++;
+				else
+					self->stats.lobbyRequests++;
+				self->start();
+			});
+	}
+
+	void stop() {
+		stopped = true;
+	}
+
+private:
+	asio::io_context& io_context;
+	const asio::ip::tcp::endpoint server;
+	Stats& stats;
+	const std::string request;
+	bool stopped = false;
+};
+
+class Match : public std::enable_shared_from_this<Match>
+{
+public:
+	Match(asio::io_context& io_context, unsigned index, const Options& options, Stats& stats)
+		: io_context(io_context), index(index), options(options), stats(stats), timer(io_context)
+	{
+	}
+
+	void start()
+	{
+		std::array<uint8_t, 8> slots;
+		slots.fill(0);	// Open
+		createTime = the_clock::now();
+		httpPost(io_context, options.httpServer, "AFODC/CGI/AFODCCGI",
+				createGameRequest("LOAD" + std::to_string(index), 3, 63, slots, "LD" + std::to_string(index)),
+				std::bind(&Match::onGameCreated, shared_from_this(), std::placeholders::_1,
+						std::placeholders::_2, std::placeholders::_3));
+	}
+
+	void stop()
+	{
+		stopped = true;
+		timer.cancel();
+		for (auto& player : players)
+		{
+			std::error_code ignored;
+			player->tcpSocket.close(ignored);
+			player->udpSocket.close(ignored);
+		}
+	}
+
+private:
+	struct Player
+	{
+		Player(asio::io_context& io_context, unsigned slot)
+			: slot(slot), tcpSocket(io_context), udpSocket(io_context) {
+		}
+		const unsigned slot;
+		asio::ip::tcp::socket tcpSocket;
+		asio::ip::udp::socket udpSocket;
+		std::vector<uint8_t> login;
+		bool loggedIn = false;
+		uint32_t sequence = 0;
+		std::array<uint8_t, 2048> tcpRecvBuffer;
+		std::array<uint8_t, 1510> udpRecvBuffer;
+		asio::ip::udp::endpoint udpSource;
+	};
+
+	void onGameCreated(const std::error_code& ec, int status, const std::string& content)
+	{
+		if (stopped)
+			return;
+		int port = -1;
+		if (!ec && status == 200)
+			port = parseGamePort(content);
+		if (port <= 0)
+		{
+			if (ec)
+				fprintf(stderr, "Match %d: game creation failed: %s\n", index, ec.message().c_str());
+			else
+				fprintf(stderr, "Match %d: game creation failed: HTTP status %d\n", index, status);
+			stats.gamesFailed++;
+			return;
+		}
+		stats.gamesCreated++;
+		stats.createLatencies.push_back(
+				asio::chrono::duration_cast<asio::chrono::microseconds>(the_clock::now() - createTime).count());
+		gameEndpoint = asio::ip::tcp::endpoint(options.httpServer.address(), port);
+		udpEndpoint = asio::ip::udp::endpoint(options.httpServer.address(), port + 1);
+		// The game creator must log in first
+		connect(0);
+	}
+
+	void connect(unsigned slot)
+	{
+		if (stopped || slot >= options.playersPerGame)
+			return;
+		players.push_back(std::make_unique<Player>(io_context, slot));
+		Player *player = players.back().get();
+		const asio::ip::address_v4 address = clientAddress(index, slot);
+		std::error_code ec;
+		player->tcpSocket.open(asio::ip::tcp::v4());
+		player->tcpSocket.bind(asio::ip::tcp::endpoint(address, 0), ec);
+		player->udpSocket.open(asio::ip::udp::v4());
+		player->udpSocket.set_option(asio::socket_base::reuse_address(true));
+		if (!ec)
+			player->udpSocket.bind(asio::ip::udp::endpoint(address, 7980), ec);
+		if (ec) {
+			fprintf(stderr, "Match %d: can't bind to %s: %s\n", index, address.to_string().c_str(), ec.message().c_str());
+			return;
+		}
+		// Alternate army and alien players so that both sides fill up evenly
+		player->login = loginPacket("P" + std::to_string(index % 1000) + "_" + std::to_string(slot), slot % 2 == 1);
+		player->tcpSocket.async_connect(gameEndpoint,
+			[self = shared_from_this(), player](const std::error_code& ec)
+			{
+				if (ec) {
+					if (ec != asio::error::operation_aborted)
+						fprintf(stderr, "Match %d: TCP connection failed: %s\n", self->index, ec.message().c_str());
+					return;
+				}
+				asio::async_write(player->tcpSocket, asio::buffer(player->login),
+						[](const std::error_code&, size_t) {});
+				self->tcpReceive(*player);
+				self->udpReceive(*player);
+			});
+	}
+
+	void tcpReceive(Player& player)
+	{
+		Player *pplayer = &player;
+		player.tcpSocket.async_read_some(asio::buffer(player.tcpRecvBuffer),
+			[self = shared_from_this(), pplayer](const std::error_code& ec, size_t)
+			{
+				if (ec || self->stopped)
+					return;
+				if (!pplayer->loggedIn)
+				{
+					// Login reply received
+					pplayer->loggedIn = true;
+					self->stats.playersLoggedIn++;
+					if (pplayer->slot == 0)
+						self->onTick({});
+					self->connect(pplayer->slot + 1);
+				}
+				self->tcpReceive(*pplayer);
+			});
+	}
+
+	void udpReceive(Player& player)
+	{
+		Player *pplayer = &player;
+		player.udpSocket.async_receive_from(asio::buffer(player.udpRecvBuffer), player.udpSource,
+			[self = shared_from_this(), pplayer](const std::error_code& ec, size_t len)
+			{
+				if (ec || self->stopped)
+					return;
+				if (len >= sizeof(UdpPacket))
+				{
+					UdpPacket packet;
+					memcpy(&packet, pplayer->udpRecvBuffer.data(), sizeof(packet));
+					self->stats.udpReceived++;
+					self->stats.udpBytesReceived += len;
+					self->stats.relayLatencies.push_back((uint32_t)((nanoTime() - packet.sendTime) / 1000));
+				}
+				else {
+					self->stats.pingsReceived++;
+				}
+				self->udpReceive(*pplayer);
+			});
+	}
+
+	void onTick(const std::error_code& ec)
+	{
+		if (ec || stopped)
+			return;
+		std::vector<uint8_t> data(std::max<size_t>(options.packetSize, sizeof(UdpPacket)));
+		for (auto& player : players)
+		{
+			if (!player->loggedIn)
+				continue;
+			UdpPacket packet { (uint16_t)data.size(), (uint8_t)(player->sequence % 4 == 0 ? 0x03 : 0x78),
+				(uint8_t)player->slot, player->sequence++, nanoTime() };
+			memcpy(data.data(), &packet, sizeof(packet));
+			std::error_code ec;
+			player->udpSocket.send_to(asio::buffer(data), udpEndpoint, 0, ec);
+			if (!ec)
+				stats.udpSent++;
+		}
+		if (lastTick == the_clock::time_point())
+			lastTick = the_clock::now();
+		lastTick += asio::chrono::microseconds(1000000 / options.packetRate);
+		timer.expires_at(lastTick);
+		timer.async_wait(std::bind(&Match::onTick, shared_from_this(), std::placeholders::_1));
+	}
+
+	asio::io_context& io_context;
+	const unsigned index;
+	const Options& options;
+	Stats& stats;
+	asio::steady_timer timer;
+	the_clock::time_point createTime;
+	the_clock::time_point lastTick;
+	asio::ip::tcp::endpoint gameEndpoint;
+	asio::ip::udp::endpoint udpEndpoint;
+	std::vector<std::unique_ptr<Player>> players;
+	bool stopped = false;
+};
+
+static void usage(const char *progName)
+{
+	fprintf(stderr, "Usage: %s [options]\n", progName);
+	fprintf(stderr, "  -a  server address (default 127.0.0.1)\n");
+	fprintf(stderr, "  -p  server HTTP port (default 8080)\n");
+	fprintf(stderr, "  -g  number of games (default 10)\n");
+	fprintf(stderr, "  -P  players per game, 1-8 (default 8)\n");
+	fprintf(stderr, "  -r  UDP packets per second per player (default 30)\n");
+	fprintf(stderr, "  -b  UDP packet size in bytes (default 64)\n");
+	fprintf(stderr, "  -l  number of concurrent lobby pollers (default 4)\n");
+	fprintf(stderr, "  -d  test duration in seconds (default 30)\n");
+	fprintf(stderr, "Each game uses one game port on the server. Clients use loopback addresses 127.1.0.1 and above.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	Options options;
+	std::string address = "127.0.0.1";
+	uint16_t httpPort = 8080;
+	int opt;
+	while ((opt = getopt(argc, argv, "a:p:g:P:r:b:l:d:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'a': address = optarg; break;
+		case 'p': httpPort = atoi(optarg); break;
+		case 'g': options.games = atoi(optarg); break;
+		case 'P': options.playersPerGame = atoi(optarg); break;
+		case 'r': options.packetRate = atoi(optarg); break;
+		case 'b': options.packetSize = atoi(optarg); break;
+		case 'l': options.lobbyPollers = atoi(optarg); break;
+		case 'd': options.duration = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc || options.playersPerGame < 1 || options.playersPerGame > 8
+			|| options.packetRate == 0 || options.packetSize > 1500 || options.duration == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	options.httpServer = asio::ip::tcp::endpoint(asio::ip::make_address(address), httpPort);
+
+	asio::io_context io_context;
+	Stats stats;
+	std::vector<std::shared_ptr<LobbyPoller>> pollers;
+	for (unsigned i = 0; i < options.lobbyPollers; i++) {
+		pollers.push_back(std::make_shared<LobbyPoller>(io_context, options.httpServer, stats));
+		pollers.back()->start();
+	}
+	std::vector<std::shared_ptr<Match>> matches;
+	for (unsigned i = 0; i < options.games; i++) {
+		matches.push_back(std::make_shared<Match>(io_context, i, options, stats));
+		matches.back()->start();
+	}
+
+	// Periodic report
+	asio::steady_timer reportTimer(io_context);
+	const the_clock::time_point start = the_clock::now();
+	Stats last;
+	unsigned elapsed = 0;
+	std::function<void(const std::error_code&)> report = [&](const std::error_code& ec) {
+		if (ec)
+			return;
+		elapsed++;
+		printf("[%3ds] lobby %lu req/s  games %u  players %u  UDP out %lu/s in %lu/s (%lu KB/s)\n",
+				elapsed, stats.lobbyRequests - last.lobbyRequests, stats.gamesCreated, stats.playersLoggedIn,
+				stats.udpSent - last.udpSent, stats.udpReceived - last.udpReceived,
+				(stats.udpBytesReceived - last.udpBytesReceived) / 1024);
+		last.lobbyRequests = stats.lobbyRequests;
+		last.udpSent = stats.udpSent;
+		last.udpReceived = stats.udpReceived;
+		last.udpBytesReceived = stats.udpBytesReceived;
+		if (elapsed >= options.duration)
+		{
+			for (auto& poller : pollers)
+				poller->stop();
+			for (auto& match : matches)
+				match->stop();
+			io_context.stop();
+			return;
+		}
+		reportTimer.expires_at(reportTimer.expiry() + asio::chrono::seconds(1));
+		reportTimer.async_wait(report);
+	};
+	reportTimer.expires_after(asio::chrono::seconds(1));
+	reportTimer.async_wait(report);
+
+	io_context.run();
+
+	const double secs = asio::chrono::duration_cast<asio::chrono::milliseconds>(the_clock::now() - start).count() / 1000.0;
+	printf("\nLobby: %lu requests (%.0f/s), %lu errors\n", stats.lobbyRequests, stats.lobbyRequests / secs, stats.lobbyErrors);
+	printf("Games: %u created, %u failed, %u players logged in\n", stats.gamesCreated, stats.gamesFailed, stats.playersLoggedIn);
+	printf("UDP: %lu sent, %lu relayed (%.0f/s, %.0f KB/s), %lu pings\n", stats.udpSent, stats.udpReceived,
+			stats.udpReceived / secs, stats.udpBytesReceived / secs / 1024, stats.pingsReceived);
+	stats.printLatencies();
+
+	return 0;
+}
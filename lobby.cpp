@@ -0,0 +1,179 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "lobby.h"
+#include "player.h"
+#include "log.h"
+#include "json.hpp"
+#include <zlib.h>
+
+using namespace nlohmann;
+
+const char *gameTypeName(Game::GameType type)
+{
+	switch (type)
+	{
+	case Game::Watch:
+		return "watch";
+	case Game::Competition:
+		return "competition";
+	case Game::DeathMatch:
+		return "deathmatch";
+	case Game::TeamFortress:
+		return "teamfortress";
+	case Game::CaptureTheFlag:
+		return "capturetheflag";
+	default:
+		return "none";
+	}
+}
+
+static const char *slotTypeName(Game::SlotType type)
+{
+	switch (type)
+	{
+	case Game::Open:
+		return "open";
+	case Game::Open_CPU:
+		return "open_cpu";
+	case Game::Filled:
+	case Game::Filled2:
+		return "filled";
+	case Game::CPU:
+		return "cpu";
+	case Game::Balanced:
+		return "balanced";
+	default:
+		return "closed";
+	}
+}
+
+static std::string gzip(const std::string& data)
+{
+	z_stream stream {};
+	// 16 + MAX_WBITS: gzip header and trailer
+	if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return {};
+	std::string out;
+	out.resize(deflateBound(&stream, data.size()));
+	stream.next_in = (Bytef *)data.data();
+	stream.avail_in = data.size();
+	stream.next_out = (Bytef *)&out[0];
+	stream.avail_out = out.size();
+	int rc = deflate(&stream, Z_FINISH);
+	deflateEnd(&stream);
+	if (rc != Z_STREAM_END)
+		return {};
+	out.resize(stream.total_out);
+	return out;
+}
+
+static std::string dump(const json& j) {
+	// Game and player names come from the clients and may not be valid UTF-8
+	return j.dump(-1, ' ', false, json::error_handler_t::replace);
+}
+
+void LobbySnapshot::update(const std::vector<Game::Ptr>& games, size_t freeGames)
+{
+	json jgames = json::array();
+	for (const auto& game : games)
+	{
+		json slots = json::array();
+		for (int i = 0; i < 8; i++)
+		{
+			json slot = {
+				{ "type", slotTypeName(game->getSlotType(i)) },
+				{ "side", i < 4 ? "army" : "alien" },
+			};
+			Player::Ptr player = game->getPlayer(i);
+			if (player != nullptr)
+				slot["player"] = player->getName();
+			slots.push_back(slot);
+		}
+		jgames.push_back({
+			{ "name", game->getName() },
+			{ "port", game->getIpPort() },
+			{ "type", gameTypeName(game->getType()) },
+			{ "maps", game->getMaps() },
+			{ "players", game->getPlayerCount() },
+			{ "spectators", game->getSpectatorCount() },
+			{ "slots", slots },
+		});
+	}
+	json j = {
+		{ "games", jgames },
+		{ "free_games", freeGames },
+	};
+	auto content = std::make_shared<std::string>(dump(j));
+	std::string compressed = gzip(*content);
+	if (compressed.empty()) {
+		WARN_LOG("Lobby snapshot compression failed");
+		gzipContent = nullptr;
+	}
+	else {
+		gzipContent = std::make_shared<const std::string>(std::move(compressed));
+	}
+	jsonContent = std::move(content);
+	this->freeGames = freeGames;
+	valid = true;
+}
+
+void LobbyEvents::gameCreated(const Game& game)
+{
+	json slots = json::array();
+	for (int i = 0; i < 8; i++)
+		slots.push_back(slotTypeName(game.getSlotType(i)));
+	json j = {
+		{ "port", game.getIpPort() },
+		{ "name", game.getName() },
+		{ "type", gameTypeName(game.getType()) },
+		{ "maps", game.getMaps() },
+		{ "slots", slots },
+	};
+	eventSource.publish("game_created", dump(j));
+}
+
+void LobbyEvents::playerJoined(const Game& game, int slot)
+{
+	json j = {
+		{ "port", game.getIpPort() },
+		{ "game", game.getName() },
+		{ "player", game.getPlayer(slot)->getName() },
+		{ "slot", slot },
+	};
+	eventSource.publish("player_joined", dump(j));
+}
+
+void LobbyEvents::playerLeft(const Game& game, const Player& player, int slot)
+{
+	json j = {
+		{ "port", game.getIpPort() },
+		{ "game", game.getName() },
+		{ "player", player.getName() },
+		{ "slot", slot },
+	};
+	eventSource.publish("player_left", dump(j));
+}
+
+void LobbyEvents::gameTerminated(const Game& game)
+{
+	json j = {
+		{ "port", game.getIpPort() },
+		{ "name", game.getName() },
+	};
+	eventSource.publish("game_terminated", dump(j));
+}
@@ -0,0 +1,86 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "game.h"
+#include "http.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+class Player;
+
+/// Name of the game type used in the JSON documents
+const char *gameTypeName(Game::GameType type);
+
+/// JSON description of the running games for web dashboards (/api/games).
+/// The JSON document and its gzip-compressed version are only rebuilt after
+/// the lobby has changed, and are shared by all the replies sent until then.
+class LobbySnapshot
+{
+public:
+	using Content = std::shared_ptr<const std::string>;
+
+	/// Marks the snapshot as stale. It will be rebuilt on the next request.
+	void invalidate() {
+		valid = false;
+	}
+	bool isValid() const {
+		return valid;
+	}
+
+	/// Serializes the games and the number of games that can still be created into a new snapshot
+	void update(const std::vector<Game::Ptr>& games, size_t freeGames);
+	size_t getFreeGames() const {
+		return freeGames;
+	}
+
+	const Content& getJson() const {
+		return jsonContent;
+	}
+	/// Returns the gzip-compressed JSON or nullptr if compression failed
+	const Content& getGzipJson() const {
+		return gzipContent;
+	}
+
+private:
+	bool valid = false;
+	size_t freeGames = 0;
+	Content jsonContent;
+	Content gzipContent;
+};
+
+/// Lobby changes streamed to web clients as server-sent events (/api/events):
+/// game_created, player_joined, player_left and game_terminated.
+class LobbyEvents
+{
+public:
+	explicit LobbyEvents(asio::io_context& io_context)
+		: eventSource(io_context) {}
+
+	void gameCreated(const Game& game);
+	void playerJoined(const Game& game, int slot);
+	void playerLeft(const Game& game, const Player& player, int slot);
+	void gameTerminated(const Game& game);
+
+	EventSource& getEventSource() {
+		return eventSource;
+	}
+
+private:
+	EventSource eventSource;
+};
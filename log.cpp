@@ -17,8 +17,13 @@
 */
 #include "log.h"
 #include <string>
+#include <atomic>
 #include <cstdarg>
 #include <cstdio>
+#include <ctime>
+
+static std::atomic<uint64_t> dropCount;
+static std::atomic<int> maxLevel { Log::DEBUG };
 
 const char *LevelNames[] = {
 	"ERROR",
@@ -30,6 +35,8 @@ const char *LevelNames[] = {
 
 void logger(Log::LEVEL level, const char* file, int line, const char *format, ...)
 {
+	if (level > maxLevel.load(std::memory_order_relaxed))
+		return;
 	va_list args;
 	va_start(args, format);
 	char *temp;
@@ -47,10 +54,19 @@ void logger(Log::LEVEL level, const char* file, int line, const char *format, ..
 	free(temp);
 	if (len < 0)
 		throw std::bad_alloc();
-	fputs(msg, stderr);
+	if (fputs(msg, stderr) == EOF)
+		dropCount.fetch_add(1, std::memory_order_relaxed);
 	free(msg);
 }
 
+void setLogLevel(Log::LEVEL level) {
+	maxLevel.store(level, std::memory_order_relaxed);
+}
+
+uint64_t getLogDropCount() {
+	return dropCount.load(std::memory_order_relaxed);
+}
+
 void dumpData(const uint8_t *data, size_t len)
 {
 	for (size_t i = 0; i < len;)
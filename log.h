@@ -63,3 +63,9 @@ void logger(Log::LEVEL level, const char *file, int line, const char *format, ..
 #endif
 
 void dumpData(const uint8_t *data, size_t len);
+
+/// Discards the messages less important than the given level
+void setLogLevel(Log::LEVEL level);
+
+/// Number of log messages that couldn't be written
+uint64_t getLogDropCount();
@@ -0,0 +1,101 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "metrics.h"
+#include <cstdio>
+
+void MetricsWriter::header(const char *name, const char *type, const char *help)
+{
+	out += "# HELP ";
+	out += name;
+	out += ' ';
+	out += help;
+	out += "\n# TYPE ";
+	out += name;
+	out += ' ';
+	out += type;
+	out += '\n';
+}
+
+void MetricsWriter::writeName(const char *name, const char *suffix, const char *labels, const char *extraLabel)
+{
+	out += name;
+	if (suffix != nullptr)
+		out += suffix;
+	const bool hasLabels = labels != nullptr && labels[0] != '\0';
+	if (hasLabels || extraLabel != nullptr)
+	{
+		out += '{';
+		if (hasLabels)
+			out += labels;
+		if (extraLabel != nullptr)
+		{
+			if (hasLabels)
+				out += ',';
+			out += extraLabel;
+		}
+		out += '}';
+	}
+	out += ' ';
+}
+
+void MetricsWriter::sample(const char *name, const char *labels, uint64_t value)
+{
+	writeName(name, nullptr, labels);
+	char buf[24];
+	int len = snprintf(buf, sizeof(buf), "%lu\n", (unsigned long)value);
+	out.append(buf, len);
+}
+
+void MetricsWriter::sample(const char *name, const char *labels, double value)
+{
+	writeName(name, nullptr, labels);
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "%.6g\n", value);
+	out.append(buf, len);
+}
+
+void MetricsWriter::histogram(const char *name, const char *labels, const LatencyHistogram& histogram)
+{
+	// Bucket bounds in nanoseconds, rounded up to the histogram bucket bounds
+	// so that the cumulative counts include all the values below them
+	static const uint64_t bounds[] {
+		10000, 50000, 100000, 250000, 500000,
+		1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+		100000000, 250000000, 500000000, 1000000000, 2500000000, 5000000000
+	};
+	char label[32];
+	for (uint64_t bound : bounds)
+	{
+		bound = LatencyHistogram::roundUpToBucket(bound);
+		snprintf(label, sizeof(label), "le=\"%.9g\"", bound / 1e9);
+		writeName(name, "_bucket", labels, label);
+		char buf[24];
+		int len = snprintf(buf, sizeof(buf), "%lu\n", (unsigned long)histogram.countAtOrBelow(bound));
+		out.append(buf, len);
+	}
+	writeName(name, "_bucket", labels, "le=\"+Inf\"");
+	char buf[32];
+	int len = snprintf(buf, sizeof(buf), "%lu\n", (unsigned long)histogram.count());
+	out.append(buf, len);
+	writeName(name, "_sum", labels);
+	len = snprintf(buf, sizeof(buf), "%.9g\n", histogram.getSum() / 1e9);
+	out.append(buf, len);
+	writeName(name, "_count", labels);
+	len = snprintf(buf, sizeof(buf), "%lu\n", (unsigned long)histogram.count());
+	out.append(buf, len);
+}
@@ -0,0 +1,43 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "stats.h"
+#include <string>
+
+/// Writes metrics in the Prometheus text exposition format into a string.
+/// The string can be reused between calls to avoid allocations.
+class MetricsWriter
+{
+public:
+	explicit MetricsWriter(std::string& out) : out(out) {
+		out.clear();
+	}
+
+	/// Writes the HELP and TYPE lines of a metric family
+	void header(const char *name, const char *type, const char *help);
+	/// Writes a sample. labels can be null or a comma-separated list of label="value" pairs.
+	void sample(const char *name, const char *labels, uint64_t value);
+	void sample(const char *name, const char *labels, double value);
+	/// Writes a histogram with values in seconds
+	void histogram(const char *name, const char *labels, const LatencyHistogram& histogram);
+
+private:
+	void writeName(const char *name, const char *suffix, const char *labels, const char *extraLabel = nullptr);
+
+	std::string& out;
+};
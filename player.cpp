@@ -17,7 +17,6 @@
 */
 #include "player.h"
 #include "game.h"
-#include "discord.h"
 
 void GameConnection::start()
 {
@@ -127,6 +126,7 @@ void GameConnection::close()
 
 bool Player::receiveTcp(const uint8_t *data, size_t len)
 {
+	game->capturePacket(PacketCapture::Tcp, PacketCapture::In, slotNum, connectionId, data, len);
 	switch (data[2])
 	{
 	case 0: // Login
@@ -134,12 +134,17 @@ bool Player::receiveTcp(const uint8_t *data, size_t len)
 			if (data[7] == 0)
 			{
 				// Spectator
+				if (!game->addSpectator(shared_from_this()))
+				{
+					WARN_LOG("Spectator %s rejected: too many spectators", endpoint.address().to_string().c_str());
+					disconnect();
+					return false;
+				}
 				NOTICE_LOG("Adding spectator: %s", endpoint.address().to_string().c_str());
-				game->addSpectator(shared_from_this());
 				//uint8_t data[] { 0, 255, 0 };
 				//connection->sendPacket(0, data, sizeof(data));
 				uint8_t data[] { 1, 0, 0 }; // 1 occupied slot at 0?
-				connection->sendPacket(0, data, sizeof(data));
+				sendPacket(0, data, sizeof(data));
 
 				game->sendPlayerList();
 				return true;
@@ -156,28 +161,9 @@ bool Player::receiveTcp(const uint8_t *data, size_t len)
 			bool alien = (bool)data[36];
 			assignSlot(alien);
 			uint8_t data[] { 1, (uint8_t)slotNum, 0 };
-			connection->sendPacket(0, data, sizeof(data));
+			sendPacket(0, data, sizeof(data));
 
 			game->sendPlayerList();
-			int armySlots = 0, alienSlots = 0;
-			std::vector<std::string> players;
-			for (int i = 0; i < 8; i++)
-			{
-				if (game->getSlotType(i) == Game::Open || game->getSlotType(i) == Game::Open_CPU)
-				{
-					if (i >= 4)
-						alienSlots++;
-					else
-						armySlots++;
-				}
-				else if (game->getPlayer(i) != nullptr) {
-					players.push_back(game->getPlayer(i)->getName());
-				}
-			}
-			if (players.size() == 1)
-				discordGameCreated(game->getType(), game->getName(), name, armySlots, alienSlots);
-			else
-				discordGameJoined(game->getType(), game->getName(), name, players, armySlots, alienSlots);
 
 			return true;
 		}
@@ -203,7 +189,7 @@ bool Player::receiveTcp(const uint8_t *data, size_t len)
 		break;
 	case 0x78: // ???
 		DEBUG_LOG("%s [%s][slot %d] Packet 78", name.c_str(), getIp().c_str(), slotNum);
-		connection->sendPacket(0x78, &data[3], len - 3);
+		sendPacket(0x78, &data[3], len - 3);
 		// broadcast to other players
 		if (slotNum != -1)
 			game->tcpSendToAll(data, len, shared_from_this());
@@ -217,7 +203,21 @@ bool Player::receiveTcp(const uint8_t *data, size_t len)
 }
 
 void Player::sendTcp(const uint8_t *data, size_t len) {
-	connection->sendPacket(data[2], &data[3], len - 3);
+	sendPacket(data[2], &data[3], len - 3);
+}
+
+void Player::sendPacket(uint8_t opcode, const uint8_t *payload, unsigned size)
+{
+	if (game != nullptr)
+		game->captureTcp(PacketCapture::Out, slotNum, connectionId, opcode, payload, size);
+	connection->sendPacket(opcode, payload, size);
+}
+
+void Player::setExtraData(const uint8_t *data)
+{
+	memcpy(extraData.data(), data, sizeof(extraData));
+	if (slotNum != -1 && game != nullptr)
+		game->updatePlayerList(slotNum);
 }
 
 int Player::assignSlot(bool alien)
@@ -229,6 +229,8 @@ int Player::assignSlot(bool alien)
 
 void Player::disconnect()
 {
+	// The connection may hold the last reference to this player
+	Ptr self = shared_from_this();
 	if (connection != nullptr) {
 		connection->close();
 		connection = nullptr;
@@ -79,6 +79,7 @@ private:
 	static constexpr size_t MAX_PKT_LEN = 512;
 
 	friend super;
+	friend class BenchAccess;
 };
 
 class Game;
@@ -87,15 +88,17 @@ class Player : public SharedThis<Player>
 {
 public:
 	const std::string& getName() const { return name; }
+	// Must be set before a slot is assigned
 	void setName(const std::string& name) { this->name = name; }
 
 	const std::array<uint8_t, 8>& getExtraData() const { return extraData; }
-	void setExtraData(const uint8_t *data) { memcpy(extraData.data(), data, sizeof(extraData)); }
+	void setExtraData(const uint8_t *data);
 
 	std::string getIp() const {
 		return endpoint.address().to_string();
 	}
 	const asio::ip::udp::endpoint& getUdpEndpoint() const { return endpoint; }
+	uint16_t getConnectionId() const { return connectionId; }
 
 	int assignSlot(bool alien);
 	void resetSlotNum() { slotNum = -1; }
@@ -105,18 +108,22 @@ public:
 	void disconnect();
 
 private:
-	Player(GameConnection::Ptr connection, std::shared_ptr<Game> game)
+	Player(GameConnection::Ptr connection, std::shared_ptr<Game> game, uint16_t connectionId)
 		: endpoint(connection->getSocket().remote_endpoint().address(), 7980),
-		  connection(connection), game(game)
+		  connection(connection), game(game), connectionId(connectionId)
 	{
 	}
 
+	void sendPacket(uint8_t opcode, const uint8_t *payload, unsigned size);
+
 	std::string name;
 	asio::ip::udp::endpoint endpoint;
 	std::shared_ptr<GameConnection> connection;
 	std::shared_ptr<Game> game;
 	std::array<uint8_t, 8> extraData;	// offset 1: 0=army, 1=alien
 	int slotNum = -1;
+	uint16_t connectionId;	// connection number in the game
 
 	friend super;
+	friend class BenchAccess;
 };
@@ -0,0 +1,228 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "portpool.h"
+#include "log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+PortPool::PortPool(uint16_t portMin, uint16_t portMax, ActivatedSockets&& activated,
+		const std::vector<uint16_t>& excluded)
+	: portMin(portMin), portMax(portMax), excluded(excluded), activated(std::move(activated))
+{
+	fill();
+}
+
+PortPool::~PortPool()
+{
+	for (auto& [port, entry] : ports)
+	{
+		::close(entry.tcpFd);
+		::close(entry.udpFd);
+	}
+	for (auto& [port, fd] : activated.gameTcpFds)
+		::close(fd);
+	for (auto& [port, fd] : activated.gameUdpFds)
+		::close(fd);
+}
+
+void PortPool::setRange(uint16_t portMin, uint16_t portMax)
+{
+	this->portMin = portMin;
+	this->portMax = portMax;
+	for (auto it = ports.begin(); it != ports.end(); )
+	{
+		auto next = std::next(it);
+		if (!it->second.used && (it->first < portMin || it->first > portMax))
+			closePort(it);
+		it = next;
+	}
+	fill();
+}
+
+void PortPool::include(const std::vector<uint16_t>& ports)
+{
+	for (uint16_t port : ports)
+		excluded.erase(std::remove(excluded.begin(), excluded.end(), port), excluded.end());
+	fill();
+}
+
+void PortPool::close()
+{
+	closed = true;
+	for (auto it = ports.begin(); it != ports.end(); )
+	{
+		auto next = std::next(it);
+		if (!it->second.used)
+			closePort(it);
+		it = next;
+	}
+}
+
+void PortPool::getFreeSockets(std::unordered_map<uint16_t, int>& tcpFds, std::unordered_map<uint16_t, int>& udpFds) const
+{
+	for (uint16_t port : freePorts)
+	{
+		const Port& entry = ports.at(port);
+		tcpFds[port] = entry.tcpFd;
+		udpFds[port] = entry.udpFd;
+	}
+}
+
+bool PortPool::acquire(uint16_t& port, int& tcpFd, int& udpFd)
+{
+	while (!freePorts.empty())
+	{
+		port = freePorts.back();
+		auto it = ports.find(port);
+		Port& entry = it->second;
+		// Discard the datagrams received while the port was idle
+		uint8_t buf[16];
+		while (recv(entry.udpFd, buf, sizeof(buf), MSG_DONTWAIT) >= 0)
+			;
+		if (listen(entry.tcpFd, SOMAXCONN) < 0)
+		{
+			// Drop the port so that the next one is used
+			ERROR_LOG("Can't listen on port %d: %s", port, strerror(errno));
+			closePort(it);
+			continue;
+		}
+		tcpFd = fcntl(entry.tcpFd, F_DUPFD_CLOEXEC, 0);
+		udpFd = fcntl(entry.udpFd, F_DUPFD_CLOEXEC, 0);
+		if (tcpFd < 0 || udpFd < 0)
+		{
+			// Out of file descriptors: the other ports won't do better
+			ERROR_LOG("Can't duplicate the sockets of port %d: %s", port, strerror(errno));
+			shutdown(entry.tcpFd, SHUT_RD);
+			if (tcpFd >= 0)
+				::close(tcpFd);
+			if (udpFd >= 0)
+				::close(udpFd);
+			return false;
+		}
+		freePorts.pop_back();
+		entry.used = true;
+		return true;
+	}
+	return false;
+}
+
+void PortPool::release(uint16_t port)
+{
+	auto it = ports.find(port);
+	if (it == ports.end())
+		return;
+	if (closed || port < portMin || port > portMax) {
+		closePort(it);
+		return;
+	}
+	// Stop listening and reset the connections waiting to be accepted.
+	// The socket stays bound to the port.
+	shutdown(it->second.tcpFd, SHUT_RD);
+	it->second.used = false;
+	freePorts.insert(std::lower_bound(freePorts.begin(), freePorts.end(), port), port);
+}
+
+void PortPool::fill()
+{
+	if (closed)
+		return;
+	size_t failed = 0;
+	for (unsigned port = portMin; port <= portMax; port++)
+	{
+		if (ports.count(port) != 0
+				|| std::find(excluded.begin(), excluded.end(), port) != excluded.end())
+			continue;
+		if (openPort(port))
+			freePorts.insert(std::lower_bound(freePorts.begin(), freePorts.end(), port), port);
+		else
+			failed++;
+	}
+	if (failed != 0)
+		WARN_LOG("%zd game port(s) couldn't be opened", failed);
+}
+
+// Opens the TCP and UDP (port + 1) sockets of a game port
+bool PortPool::openPort(uint16_t port)
+{
+	int tcpFd = -1;
+	auto it = activated.gameTcpFds.find(port);
+	if (it != activated.gameTcpFds.end())
+	{
+		tcpFd = it->second;
+		activated.gameTcpFds.erase(it);
+		shutdown(tcpFd, SHUT_RD);
+	}
+	int udpFd = -1;
+	it = activated.gameUdpFds.find(port);
+	if (it != activated.gameUdpFds.end())
+	{
+		udpFd = it->second;
+		activated.gameUdpFds.erase(it);
+	}
+	sockaddr_in addr {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (tcpFd < 0)
+	{
+		tcpFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		int one = 1;
+		addr.sin_port = htons(port);
+		if (tcpFd < 0
+				|| setsockopt(tcpFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+				|| bind(tcpFd, (sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			WARN_LOG("Can't bind TCP port %d: %s", port, strerror(errno));
+			if (tcpFd >= 0)
+				::close(tcpFd);
+			if (udpFd >= 0)
+				::close(udpFd);
+			return false;
+		}
+	}
+	if (udpFd < 0)
+	{
+		// No SO_REUSEADDR: the UDP port must not be shared with another process
+		udpFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		addr.sin_port = htons(port + 1);
+		if (udpFd < 0 || bind(udpFd, (sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			WARN_LOG("Can't bind UDP port %d: %s", port + 1, strerror(errno));
+			if (udpFd >= 0)
+				::close(udpFd);
+			::close(tcpFd);
+			return false;
+		}
+	}
+	ports[port] = Port{ tcpFd, udpFd, false };
+	return true;
+}
+
+void PortPool::closePort(std::map<uint16_t, Port>::iterator it)
+{
+	::close(it->second.tcpFd);
+	::close(it->second.udpFd);
+	auto freeIt = std::lower_bound(freePorts.begin(), freePorts.end(), it->first);
+	if (freeIt != freePorts.end() && *freeIt == it->first)
+		freePorts.erase(freeIt);
+	ports.erase(it);
+}
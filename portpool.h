@@ -0,0 +1,86 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include "activation.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+/// Pre-bound TCP and UDP sockets of the game ports.
+/// The sockets are opened when the range is set, so that creating a game
+/// only hands out duplicates of ready sockets. They are recycled when the game ends.
+/// Idle TCP sockets are bound but not listening.
+class PortPool
+{
+public:
+	/// Opens the sockets of the ports in the range, except the excluded ones.
+	/// Sockets passed by systemd are used when available.
+	PortPool(uint16_t portMin, uint16_t portMax, ActivatedSockets&& activated,
+			const std::vector<uint16_t>& excluded = {});
+	~PortPool();
+	PortPool(const PortPool&) = delete;
+	PortPool& operator=(const PortPool&) = delete;
+
+	/// Changes the range. Ports in use outside the new range are closed when released.
+	void setRange(uint16_t portMin, uint16_t portMax);
+	/// Opens the ports that were excluded
+	void include(const std::vector<uint16_t>& ports);
+	/// Closes the free ports and stops recycling ports, before handing over to another process
+	void close();
+	/// Adds the sockets of the free ports, which stay owned by the pool
+	void getFreeSockets(std::unordered_map<uint16_t, int>& tcpFds, std::unordered_map<uint16_t, int>& udpFds) const;
+
+	/// Returns the port and duplicates of its sockets owned by the caller.
+	/// The TCP socket is listening. A port that can't listen is closed until the range is set again.
+	/// Returns false if no port is available.
+	bool acquire(uint16_t& port, int& tcpFd, int& udpFd);
+	/// Makes the port available again. Its game must have closed its sockets.
+	void release(uint16_t port);
+
+	size_t available() const {
+		return freePorts.size();
+	}
+	uint16_t getPortMin() const {
+		return portMin;
+	}
+	uint16_t getPortMax() const {
+		return portMax;
+	}
+
+private:
+	struct Port
+	{
+		int tcpFd;
+		int udpFd;
+		bool used;
+	};
+
+	void fill();
+	bool openPort(uint16_t port);
+	void closePort(std::map<uint16_t, Port>::iterator it);
+
+	uint16_t portMin;
+	uint16_t portMax;
+	std::map<uint16_t, Port> ports;		// opened ports
+	std::vector<uint16_t> freePorts;	// ascending, the last one is used first
+	std::vector<uint16_t> excluded;
+	ActivatedSockets activated;
+	bool closed = false;
+};
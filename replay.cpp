@@ -0,0 +1,466 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+//
+// Replays captured games (see CaptureDir) against a local server.
+// Each capture is replayed by one or more simulated matches, each one creating its own game.
+//
+#include "asio.h"
+#include "capture.h"
+#include "client.h"
+#include <getopt.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+using the_clock = asio::chrono::steady_clock;
+
+struct Record
+{
+	uint64_t time;		// microseconds since the first record
+	uint16_t connection;
+	PacketCapture::Protocol protocol;
+	std::vector<uint8_t> data;
+};
+
+struct CaptureFile
+{
+	std::string path;
+	std::string gameName;
+	unsigned gameType = 0;
+	unsigned maps = 0;
+	std::array<uint8_t, 8> slots {};
+	std::vector<Record> records;	// client to server packets only
+	unsigned connections = 0;
+};
+
+struct Stats : ClientStats
+{
+	uint64_t tcpSent = 0;
+	uint64_t tcpReceivedBytes = 0;
+	unsigned matchesDone = 0;
+};
+
+static bool loadCapture(const std::string& path, CaptureFile& capture)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		fprintf(stderr, "Can't open %s\n", path.c_str());
+		return false;
+	}
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	uint32_t header[6];
+	if (data.size() < sizeof(header)) {
+		fprintf(stderr, "%s: truncated file\n", path.c_str());
+		return false;
+	}
+	memcpy(header, data.data(), sizeof(header));
+	if (header[0] != 0xa1b2c3d4 || header[5] != PacketCapture::LinkType) {
+		fprintf(stderr, "%s: not an afoserver capture\n", path.c_str());
+		return false;
+	}
+	capture.path = path;
+	uint64_t firstTime = 0;
+	for (size_t offset = sizeof(header); offset + 16 + sizeof(PacketCapture::RecordHeader) <= data.size(); )
+	{
+		uint32_t recHeader[4];
+		memcpy(recHeader, &data[offset], sizeof(recHeader));
+		offset += sizeof(recHeader);
+		const uint32_t len = recHeader[2];
+		if (len < sizeof(PacketCapture::RecordHeader) || offset + len > data.size())
+			break;
+		PacketCapture::RecordHeader afoHeader;
+		memcpy(&afoHeader, &data[offset], sizeof(afoHeader));
+		const uint8_t *payload = &data[offset + sizeof(afoHeader)];
+		const size_t payloadLen = len - sizeof(afoHeader);
+		offset += len;
+
+		if (afoHeader.protocol == PacketCapture::Info)
+		{
+			// Address=... Port=... Response=20 GameName=<name> GameType=n Maps=n Slots=n n n n n n n n  Sides=...
+			std::string desc((const char *)payload, payloadLen);
+			size_t start = desc.find("GameName=");
+			size_t end = desc.find(" GameType=");
+			if (start == std::string::npos || end == std::string::npos)
+				continue;
+			capture.gameName = desc.substr(start + 9, end - start - 9);
+			capture.gameType = atoi(&desc[end + 10]);
+			size_t pos = desc.find("Maps=");
+			if (pos != std::string::npos)
+				capture.maps = atoi(&desc[pos + 5]);
+			pos = desc.find("Slots=");
+			if (pos != std::string::npos)
+			{
+				const char *p = &desc[pos + 6];
+				for (auto& slot : capture.slots)
+					slot = (uint8_t)strtoul(p, (char **)&p, 10);
+			}
+			continue;
+		}
+		if (afoHeader.direction != PacketCapture::In || afoHeader.connection == 0)
+			continue;
+		uint64_t time = (uint64_t)recHeader[0] * 1000000 + recHeader[1];
+		if (capture.records.empty())
+			firstTime = time;
+		capture.records.push_back({ time - firstTime, afoHeader.connection,
+			(PacketCapture::Protocol)afoHeader.protocol, std::vector<uint8_t>(payload, payload + payloadLen) });
+		capture.connections = std::max<unsigned>(capture.connections, afoHeader.connection);
+	}
+	if (capture.gameName.empty()) {
+		fprintf(stderr, "%s: game description not found\n", path.c_str());
+		return false;
+	}
+	if (capture.connections > 254) {
+		fprintf(stderr, "%s: too many connections\n", path.c_str());
+		return false;
+	}
+	return true;
+}
+
+static uint64_t hashPacket(const uint8_t *data, size_t len)
+{
+	// FNV-1a
+	uint64_t h = 0xcbf29ce484222325;
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ data[i]) * 0x100000001b3;
+	return h;
+}
+
+class Match : public std::enable_shared_from_this<Match>
+{
+public:
+	Match(asio::io_context& io_context, const CaptureFile& capture, unsigned index,
+			const asio::ip::tcp::endpoint& httpServer, double speed, Stats& stats, std::function<void()> onDone)
+		: io_context(io_context), capture(capture), index(index), httpServer(httpServer),
+		  speed(speed), stats(stats), onDone(onDone), timer(io_context)
+	{
+	}
+
+	void start()
+	{
+		createTime = the_clock::now();
+		httpPost(io_context, httpServer, "AFODC/CGI/AFODCCGI",
+				createGameRequest(capture.gameName, capture.gameType, capture.maps, capture.slots),
+				std::bind(&Match::onGameCreated, shared_from_this(), std::placeholders::_1,
+						std::placeholders::_2, std::placeholders::_3));
+	}
+
+private:
+	struct Client
+	{
+		Client(asio::io_context& io_context)
+			: tcpSocket(io_context), udpSocket(io_context) {
+		}
+		asio::ip::tcp::socket tcpSocket;
+		asio::ip::udp::socket udpSocket;
+		bool connected = false;
+		bool writing = false;
+		std::vector<uint8_t> sendBuffer;
+		std::vector<uint8_t> writeBuffer;
+		std::array<uint8_t, 2048> tcpRecvBuffer;
+		std::array<uint8_t, 1510> udpRecvBuffer;
+		asio::ip::udp::endpoint udpSource;
+	};
+
+	void onGameCreated(const std::error_code& ec, int status, const std::string& content)
+	{
+		int port = -1;
+		if (!ec && status == 200)
+			port = parseGamePort(content);
+		if (port <= 0)
+		{
+			if (ec)
+				fprintf(stderr, "Match %d: game creation failed: %s\n", index, ec.message().c_str());
+			else
+				fprintf(stderr, "Match %d: game creation failed: HTTP status %d\n", index, status);
+			stats.gamesFailed++;
+			onDone();
+			return;
+		}
+		stats.gamesCreated++;
+		stats.createLatencies.push_back(
+				asio::chrono::duration_cast<asio::chrono::microseconds>(the_clock::now() - createTime).count());
+		gameEndpoint = asio::ip::tcp::endpoint(httpServer.address(), port);
+		udpEndpoint = asio::ip::udp::endpoint(httpServer.address(), port + 1);
+		clients.resize(capture.connections + 1);
+		startTime = the_clock::now();
+		schedule();
+	}
+
+	void schedule()
+	{
+		if (next >= capture.records.size())
+		{
+			// Give some time to the server to forward the last packets
+			timer.expires_after(asio::chrono::seconds(2));
+			timer.async_wait(std::bind(&Match::finish, shared_from_this(), std::placeholders::_1));
+			return;
+		}
+		timer.expires_at(eventTime(capture.records[next]));
+		timer.async_wait(std::bind(&Match::onTimer, shared_from_this(), std::placeholders::_1));
+	}
+
+	the_clock::time_point eventTime(const Record& record) const {
+		return startTime + asio::chrono::microseconds((uint64_t)(record.time / speed));
+	}
+
+	void onTimer(const std::error_code& ec)
+	{
+		if (ec)
+			return;
+		const auto deadline = the_clock::now() + asio::chrono::milliseconds(1);
+		for (; next < capture.records.size() && eventTime(capture.records[next]) <= deadline; next++)
+		{
+			const Record& record = capture.records[next];
+			Client& client = getClient(record.connection);
+			if (record.protocol == PacketCapture::Tcp)
+			{
+				client.sendBuffer.insert(client.sendBuffer.end(), record.data.begin(), record.data.end());
+				stats.tcpSent++;
+				tcpSend(client);
+			}
+			else if (record.protocol == PacketCapture::Udp)
+			{
+				std::error_code ec;
+				client.udpSocket.send_to(asio::buffer(record.data), udpEndpoint, 0, ec);
+				if (!ec)
+				{
+					stats.udpSent++;
+					sentPackets[hashPacket(record.data.data(), record.data.size())] = the_clock::now();
+				}
+			}
+		}
+		// Forget old packets
+		if (sentPackets.size() > 10000)
+		{
+			const auto limit = the_clock::now() - asio::chrono::seconds(5);
+			for (auto it = sentPackets.begin(); it != sentPackets.end(); )
+				if (it->second < limit)
+					it = sentPackets.erase(it);
+				else
+					++it;
+		}
+		schedule();
+	}
+
+	Client& getClient(uint16_t connection)
+	{
+		std::unique_ptr<Client>& client = clients[connection];
+		if (client != nullptr)
+			return *client;
+		client = std::make_unique<Client>(io_context);
+		const asio::ip::address_v4 address = clientAddress(index, connection - 1);
+		std::error_code ec;
+		client->tcpSocket.open(asio::ip::tcp::v4());
+		client->tcpSocket.bind(asio::ip::tcp::endpoint(address, 0), ec);
+		if (ec)
+			fprintf(stderr, "Match %d: can't bind TCP socket to %s: %s\n", index, address.to_string().c_str(), ec.message().c_str());
+		client->udpSocket.open(asio::ip::udp::v4());
+		client->udpSocket.set_option(asio::socket_base::reuse_address(true));
+		client->udpSocket.bind(asio::ip::udp::endpoint(address, 7980), ec);
+		if (ec)
+			fprintf(stderr, "Match %d: can't bind UDP socket to %s: %s\n", index, address.to_string().c_str(), ec.message().c_str());
+		Client *pclient = client.get();
+		client->tcpSocket.async_connect(gameEndpoint,
+			[self = shared_from_this(), pclient](const std::error_code& ec)
+			{
+				if (ec) {
+					if (ec != asio::error::operation_aborted)
+						fprintf(stderr, "Match %d: TCP connection failed: %s\n", self->index, ec.message().c_str());
+					return;
+				}
+				pclient->connected = true;
+				self->tcpReceive(*pclient);
+				self->tcpSend(*pclient);
+			});
+		udpReceive(*client);
+		return *client;
+	}
+
+	void tcpSend(Client& client)
+	{
+		if (!client.connected || client.writing || client.sendBuffer.empty())
+			return;
+		client.writing = true;
+		std::swap(client.sendBuffer, client.writeBuffer);
+		Client *pclient = &client;
+		asio::async_write(client.tcpSocket, asio::buffer(client.writeBuffer),
+			[self = shared_from_this(), pclient](const std::error_code& ec, size_t)
+			{
+				pclient->writing = false;
+				pclient->writeBuffer.clear();
+				if (!ec)
+					self->tcpSend(*pclient);
+			});
+	}
+
+	void tcpReceive(Client& client)
+	{
+		Client *pclient = &client;
+		client.tcpSocket.async_read_some(asio::buffer(client.tcpRecvBuffer),
+			[self = shared_from_this(), pclient](const std::error_code& ec, size_t len)
+			{
+				if (ec)
+					return;
+				self->stats.tcpReceivedBytes += len;
+				self->tcpReceive(*pclient);
+			});
+	}
+
+	void udpReceive(Client& client)
+	{
+		Client *pclient = &client;
+		client.udpSocket.async_receive_from(asio::buffer(client.udpRecvBuffer), client.udpSource,
+			[self = shared_from_this(), pclient](const std::error_code& ec, size_t len)
+			{
+				if (ec)
+					return;
+				self->stats.udpReceived++;
+				auto it = self->sentPackets.find(hashPacket(pclient->udpRecvBuffer.data(), len));
+				if (it != self->sentPackets.end())
+					self->stats.relayLatencies.push_back(
+							asio::chrono::duration_cast<asio::chrono::microseconds>(the_clock::now() - it->second).count());
+				self->udpReceive(*pclient);
+			});
+	}
+
+	void finish(const std::error_code& ec)
+	{
+		for (auto& client : clients)
+		{
+			if (client == nullptr)
+				continue;
+			std::error_code ignored;
+			client->tcpSocket.close(ignored);
+			client->udpSocket.close(ignored);
+		}
+		stats.matchesDone++;
+		onDone();
+	}
+
+	asio::io_context& io_context;
+	const CaptureFile& capture;
+	const unsigned index;
+	const asio::ip::tcp::endpoint httpServer;
+	const double speed;
+	Stats& stats;
+	std::function<void()> onDone;
+	asio::steady_timer timer;
+	the_clock::time_point createTime;
+	the_clock::time_point startTime;
+	asio::ip::tcp::endpoint gameEndpoint;
+	asio::ip::udp::endpoint udpEndpoint;
+	std::vector<std::unique_ptr<Client>> clients;	// indexed by connection number
+	size_t next = 0;
+	std::unordered_map<uint64_t, the_clock::time_point> sentPackets;
+};
+
+static void usage(const char *progName)
+{
+	fprintf(stderr, "Usage: %s [-a <server address>] [-p <http port>] [-s <speed>] [-n <matches>] <capture file>...\n", progName);
+	fprintf(stderr, "  -a  server address (default 127.0.0.1)\n");
+	fprintf(stderr, "  -p  server HTTP port (default 8080)\n");
+	fprintf(stderr, "  -s  replay speed factor (default 1.0)\n");
+	fprintf(stderr, "  -n  number of concurrent matches per capture file (default 1)\n");
+	fprintf(stderr, "Each match uses one game port on the server. Clients use loopback addresses 127.1.0.1 and above.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	std::string address = "127.0.0.1";
+	uint16_t httpPort = 8080;
+	double speed = 1.0;
+	unsigned matchCount = 1;
+	int opt;
+	while ((opt = getopt(argc, argv, "a:p:s:n:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'a': address = optarg; break;
+		case 'p': httpPort = atoi(optarg); break;
+		case 's': speed = atof(optarg); break;
+		case 'n': matchCount = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc || speed <= 0 || matchCount == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	std::vector<CaptureFile> captures;
+	for (int i = optind; i < argc; i++)
+	{
+		captures.emplace_back();
+		if (!loadCapture(argv[i], captures.back()))
+			return 1;
+		printf("%s: game %s, %d connections, %zd packets\n", argv[i], captures.back().gameName.c_str(),
+				captures.back().connections, captures.back().records.size());
+	}
+
+	asio::io_context io_context;
+	asio::ip::tcp::endpoint httpServer(asio::ip::make_address(address), httpPort);
+	Stats stats;
+	const unsigned totalMatches = matchCount * captures.size();
+	unsigned running = totalMatches;
+	auto onDone = [&]() {
+		if (--running == 0)
+			io_context.stop();
+	};
+	unsigned index = 0;
+	for (const CaptureFile& capture : captures)
+		for (unsigned i = 0; i < matchCount; i++)
+			std::make_shared<Match>(io_context, capture, index++, httpServer, speed, stats, onDone)->start();
+
+	// Periodic report
+	asio::steady_timer reportTimer(io_context);
+	const the_clock::time_point start = the_clock::now();
+	Stats last;
+	std::function<void(const std::error_code&)> report = [&](const std::error_code& ec) {
+		if (ec)
+			return;
+		printf("[%3ds] matches %u/%u  UDP out %lu/s in %lu/s  TCP out %lu/s in %lu B/s\n",
+				(int)asio::chrono::duration_cast<asio::chrono::seconds>(the_clock::now() - start).count(),
+				stats.matchesDone, totalMatches,
+				stats.udpSent - last.udpSent, stats.udpReceived - last.udpReceived,
+				stats.tcpSent - last.tcpSent, stats.tcpReceivedBytes - last.tcpReceivedBytes);
+		last.udpSent = stats.udpSent;
+		last.udpReceived = stats.udpReceived;
+		last.tcpSent = stats.tcpSent;
+		last.tcpReceivedBytes = stats.tcpReceivedBytes;
+		reportTimer.expires_at(reportTimer.expiry() + asio::chrono::seconds(1));
+		reportTimer.async_wait(report);
+	};
+	reportTimer.expires_after(asio::chrono::seconds(1));
+	reportTimer.async_wait(report);
+
+	io_context.run();
+
+	const double secs = asio::chrono::duration_cast<asio::chrono::milliseconds>(the_clock::now() - start).count() / 1000.0;
+	printf("\n%u matches replayed in %.1f s at %.1fx speed (%u game creations failed)\n",
+			stats.matchesDone, secs, speed, stats.gamesFailed);
+	printf("UDP: %lu sent, %lu received (%.0f/s forwarded)\n", stats.udpSent, stats.udpReceived, stats.udpReceived / secs);
+	printf("TCP: %lu packets sent, %lu bytes received\n", stats.tcpSent, stats.tcpReceivedBytes);
+	stats.printLatencies();
+
+	return stats.gamesFailed == 0 ? 0 : 1;
+}
@@ -18,66 +18,88 @@
 #include "log.h"
 #include "http.h"
 #include "game.h"
-#include "tomcrypt.h"
+#include "player.h"
+#include "codec.h"
 #include "db.h"
 #include "discord.h"
+#include "events.h"
+#include "capture.h"
+#include "metrics.h"
+#include "capacity.h"
+#include "cluster.h"
+#include "lobby.h"
+#include "forwarder.h"
+#include "handover.h"
+#include "activation.h"
+#include "portpool.h"
 #include <unordered_map>
 #include <fstream>
 #include <string>
 #include <vector>
 #include <algorithm>
 #include <cctype>
+#include <climits>
+#include <cstring>
+#include <unistd.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <dirent.h>
 
-static std::unordered_map<std::string, std::string> Config;
+using ConfigMap = std::unordered_map<std::string, std::string>;
+// Immutable snapshot replaced atomically when the configuration is reloaded
+static std::shared_ptr<const ConfigMap> Config = std::make_shared<ConfigMap>();
+static std::string ConfigPath;
+static std::string ExecutablePath;
 
-static void replyNotFound(const Request& request, Reply& reply) {
-	WARN_LOG("CGI not found: %s [%s]", request.uri.c_str(), request.content.c_str());
-	reply = Reply::stockReply(Reply::not_found);
-}
-
-static std::vector<uint8_t> hexStringToBytes(const std::string &s)
+// Starts a new server process with the same configuration file.
+// Only stdin, stdout and stderr are inherited: the sockets of this process are passed
+// over the handover socket, and an inherited copy would keep connections open after
+// this process closes them.
+static int spawnServer(pid_t& pid)
 {
-	std::vector<uint8_t> v;
-	v.reserve(s.length() / 2);
-	for (std::size_t pos = 0; pos < s.length() - 1; pos += 2)
+	char *const args[] { (char *)ExecutablePath.c_str(), (char *)ConfigPath.c_str(), nullptr };
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+	posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#else
+	if (DIR *dir = opendir("/proc/self/fd"))
 	{
-		int n;
-		if (sscanf(&s[pos], "%02x", &n) != 1) {
-			ERROR_LOG("Invalid hex string %s", s.c_str());
-			v.clear();
-			break;
+		while (dirent *entry = readdir(dir))
+		{
+			int fd = atoi(entry->d_name);
+			if (fd > 2 && fd != dirfd(dir))
+				fcntl(fd, F_SETFD, fcntl(fd, F_GETFD) | FD_CLOEXEC);
 		}
-		v.push_back(n);
+		closedir(dir);
 	}
-	return v;
+#endif
+	int rc = posix_spawn(&pid, ExecutablePath.c_str(), &actions, nullptr, args, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	return rc;
 }
 
-static const unsigned char NaomiKey[] = { 0x01, 0xD3, 0xB4, 0x90, 0xAB, 0x32, 0x2D, 0xC7 };
-static const unsigned char DreamcastKey[] = { 0xd4, 0x61, 0xdb, 0x19, 0x4a, 0x30, 0x17, 0xbc };
-
-static std::string decrypt(const std::string& hex, const unsigned char *key)
+// Moves the sockets to the map, replacing and closing the ones already there for the same port
+static void addSockets(std::unordered_map<uint16_t, int>& sockets, std::unordered_map<uint16_t, int>& added)
 {
-	std::vector<uint8_t> ciphered = hexStringToBytes(hex);
-	symmetric_key skey;
-	rc5_setup(key, sizeof(DreamcastKey), 0, &skey);
-	std::vector<uint8_t> plain;
-	plain.resize(ciphered.size());
-	for (size_t i = 0; i < ciphered.size(); i += 8)
-		rc5_ecb_decrypt(ciphered.data() + i, plain.data() + i, &skey);
-	rc5_done(&skey);
-	return std::string((char *)&plain[0], (char *)&plain[plain.size()]);
+	for (auto& [port, fd] : added)
+	{
+		auto it = sockets.find(port);
+		if (it != sockets.end())
+			close(it->second);
+		sockets[port] = fd;
+	}
+	added.clear();
 }
 
-static std::string descramble(const std::string& cs)
-{
-	std::vector<uint8_t> data = hexStringToBytes(cs);
-	std::string ps;
-	ps.reserve(data.size());
-	for (uint8_t c : data)
-		ps.push_back((char)~((c >> 5) | (c << 3)));
-	return ps;
+static void replyNotFound(const Request& request, Reply& reply) {
+	WARN_LOG("CGI not found: %s [%s]", request.uri.c_str(), request.content.c_str());
+	reply = Reply::stockReply(Reply::not_found);
 }
 
+static const unsigned char NaomiKey[] = { 0x01, 0xD3, 0xB4, 0x90, 0xAB, 0x32, 0x2D, 0xC7 };
+static const unsigned char DreamcastKey[] = { 0xd4, 0x61, 0xdb, 0x19, 0x4a, 0x30, 0x17, 0xbc };
+
 static std::vector<std::string> splitParams(const std::string& s)
 {
 	std::vector<std::string> params;
@@ -97,7 +119,7 @@ static std::vector<std::string> splitParams(const std::string& s)
 	return params;
 }
 
-static void handleHighScoreRequest(const Request& request, Reply& reply)
+static void handleHighScoreRequest(const Request& request, Reply& reply, EventBus& eventBus)
 {
 	DEBUG_LOG("ranking.cgi: [%s]", request.content.c_str());
 	if (request.content.substr(0, 10) == "request=1 ")
@@ -110,7 +132,9 @@ static void handleHighScoreRequest(const Request& request, Reply& reply)
 		if (params.size() >= 6)
 		{
 			try {
-				registerNewScore(atol(params[5].c_str()), params[0], params[1], params[2], params[3]);
+				int score = atol(params[5].c_str());
+				registerNewScore(score, params[0], params[1], params[2], params[3]);
+				eventBus.publish(GameEvent(params[0], score));
 				reply = Reply::stockReply(Reply::ok);
 			} catch (const std::runtime_error& e) {
 				ERROR_LOG("Naomi high score registration failed: %s", e.what());
@@ -145,7 +169,10 @@ static void handleHighScoreRequest(const Request& request, Reply& reply)
 		if (params.size() >= 4)
 		{
 			try {
-				registerNewDcScore(atol(params[3].c_str()), params[0]);
+				int score = atol(params[3].c_str());
+				registerNewDcScore(score, params[0]);
+				if (!params[0].empty() && score > 0)
+					eventBus.publish(GameEvent(params[0], score));
 			} catch (const std::runtime_error& e) {
 				ERROR_LOG("DC high score registration failed: %s", e.what());
 			}
@@ -161,32 +188,112 @@ static void handleHighScoreRequest(const Request& request, Reply& reply)
 	replyNotFound(request, reply);
 }
 
+// Reads the config file into a new snapshot. Returns false if the file can't be read.
+static bool loadConfig(const std::string& path)
+{
+	std::filebuf fb;
+	if (!fb.open(path, std::ios::in)) {
+		ERROR_LOG("config file %s not found", path.c_str());
+		return false;
+	}
+
+	auto config = std::make_shared<ConfigMap>();
+	std::istream istream(&fb);
+	std::string line;
+	while (std::getline(istream, line))
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		auto pos = line.find_first_of("=:");
+		if (pos != std::string::npos)
+			(*config)[line.substr(0, pos)] = line.substr(pos + 1);
+		else
+			ERROR_LOG("config file syntax error: %s", line.c_str());
+	}
+	std::atomic_store(&Config, std::shared_ptr<const ConfigMap>(std::move(config)));
+	return true;
+}
+
+std::string getConfig(const std::string& name, const std::string& default_value = "")
+{
+	std::shared_ptr<const ConfigMap> config = std::atomic_load(&Config);
+	auto it = config->find(name);
+	if (it == config->end())
+		return default_value;
+	else
+		return it->second;
+}
+
+static void getPortRange(uint16_t& portMin, uint16_t& portMax)
+{
+	std::string serverPorts = getConfig("ServerPorts", "9400-9419");
+	size_t pos = serverPorts.find('-');
+	portMin = 9400;
+	portMax = 9419;
+	if (pos != std::string::npos)
+	{
+		portMin = atoi(serverPorts.substr(0, pos).c_str());
+		portMax = atoi(serverPorts.substr(pos + 1).c_str());
+	}
+}
+
+// Settings that can be changed without restarting the server
+static void applyConfig()
+{
+	setDiscordWebhook(getConfig("DiscordWebhook"));
+	setCaptureDirectory(getConfig("CaptureDir"));
+	setPingInterval(asio::chrono::milliseconds(std::max(100, atoi(getConfig("PingInterval", "1000").c_str()))));
+	setPlayerTimeout(asio::chrono::seconds(std::max(1, atoi(getConfig("PlayerTimeout", "30").c_str()))));
+	setMaxSpectators(atoi(getConfig("MaxSpectators", "16").c_str()));
+	setMaxGames(atoi(getConfig("MaxGames", "0").c_str()));
+	setMemoryBudget((size_t)atoi(getConfig("MemoryBudget", "0").c_str()) * 1024 * 1024);
+	setLobbyAddresses(getConfig("LobbyAddresses"));
+}
+
 class ServerImpl : public Server
 {
 public:
-	ServerImpl(asio::io_context& io_context, const std::string& serverIp,
-			uint16_t portMin = 9400, uint16_t portMax = 9419)
+	ServerImpl(asio::io_context& io_context, const std::string& serverIp, uint16_t httpPort,
+			uint16_t portMin = 9400, uint16_t portMax = 9419, const HandoverState& handover = {},
+			const ActivatedSockets& activated = {})
 		: io_context(io_context), serverIp(serverIp),
-		  signals(io_context), httpServer(io_context, "0.0.0.0", 8080)
+		  signals(io_context), reloadSignals(io_context, SIGHUP), restartSignals(io_context, SIGUSR2), tickTimer(io_context),
+		  httpServer(io_context, "0.0.0.0", httpPort, handover.httpFd), lobbyEvents(io_context),
+		  handoverAcceptor(io_context), previousServer(io_context), nextServer(io_context),
+		  previousPorts(handover.busyPorts),
+		  portPool(portMin, portMax, ActivatedSockets(activated), handover.busyPorts),
+		  capacity(portPool), cluster(io_context)
 	{
 		signals.add(SIGINT);
 		signals.add(SIGTERM);
 #if defined(SIGQUIT)
 		signals.add(SIGQUIT);
 #endif
-		signals.async_wait(
-			[this](std::error_code /*ec*/, int /*signo*/)
-			{
-				this->io_context.stop();
-			});
+		startSignals();
+		startReloadSignal();
+		startRestartSignal();
 
-		for (uint16_t port = portMin; port <= portMax; port++)
-			ports.push_back(port);
+		if (handover.connectionFd >= 0)
+		{
+			previousServer.assign(asio::local::stream_protocol(), handover.connectionFd);
+			waitForPreviousServer();
+		}
+		capacity.sampleMemory();
+		tickTimer.expires_after(getPingInterval());
+		startTickTimer();
+		cluster.setNodes(getConfig("RelayNodes"));
 
 		// alienfnt: Server2/NaomiNetwork/CGI/Watch
 		//           Server2/NaomiNetwork/CGI/SampleCGI4
 		//           Server2/NaomiNetwork/CGI/RankingSys/ranking.cgi
-		httpServer.addCgiHandler("Server2/NaomiNetwork/CGI/RankingSys/ranking.cgi", handleHighScoreRequest);
+		eventBus.addSink(createDiscordSink(eventBus.getIoContext()));
+		addConfiguredSinks(eventBus);
+		eventBus.start();
+
+		auto highScoreHandler = [this](const Request& request, Reply& reply) {
+			handleHighScoreRequest(request, reply, eventBus);
+		};
+		httpServer.addCgiHandler("Server2/NaomiNetwork/CGI/RankingSys/ranking.cgi", highScoreHandler);
 		httpServer.addCgiHandler("Server2/NaomiNetwork/CGI/Watch",
 			[this](const Request& request, Reply& reply)
 			{
@@ -216,6 +323,8 @@ public:
 				std::string replyContent;
 				for (const auto& game : games)
 					replyContent += game->getHttpDesc(false) + " GAMEDONE\n";
+				previousGames.appendGames(replyContent);
+				cluster.appendGames(replyContent);
 				reply.setContent(replyContent + "END\n");
 			});
 		httpServer.addCgiHandler("Server2/NaomiNetwork/CGI/SampleCGI4",
@@ -226,12 +335,42 @@ public:
 			});
 		// afo: AFODC/RankingSys/ranking.cgi
 		//      AFODC/CGI/AFODCCGI
-		httpServer.addCgiHandler("AFODC/RankingSys/ranking.cgi", handleHighScoreRequest);
+		httpServer.addCgiHandler("AFODC/RankingSys/ranking.cgi", highScoreHandler);
 		httpServer.addCgiHandler("AFODC/CGI/AFODCCGI",
 			[this](const Request& request, Reply& reply)
 			{
 				this->handleHttpRequest(request, reply);
 			});
+		httpServer.addHandler("/api/games",
+			[this](const Request& request, Reply& reply)
+			{
+				this->handleGamesRequest(request, reply);
+			});
+		httpServer.addHandler("/api/events",
+			[this](const Request& request, Reply& reply)
+			{
+				reply.setEventStream(lobbyEvents.getEventSource());
+			});
+		httpServer.addHandler("/internal/node",
+			[this](const Request& request, Reply& reply)
+			{
+				if (!isLobbyAddress(request.remoteAddress)) {
+					WARN_LOG("Node report request from %s rejected", request.remoteAddress.to_string().c_str());
+					reply = Reply::stockReply(Reply::forbidden);
+					return;
+				}
+				std::string report;
+				writeNodeReport(report, this->serverIp, portPool.getPortMin(), portPool.getPortMax(),
+						draining || terminating ? 0 : capacity.getFreeGames(games.size()), games);
+				// Games of the previous process still running on this host
+				previousGames.writeGames(report);
+				reply.setContent(report);
+			});
+		httpServer.addHandler("/metrics",
+			[this](const Request& request, Reply& reply)
+			{
+				this->handleMetricsRequest(request, reply);
+			});
 	}
 
 	void deleteGame(Game::Ptr game) override
@@ -239,13 +378,230 @@ public:
 		for (size_t i = 0; i < games.size(); i++)
 			if (game == games[i])
 			{
-				ports.push_back(game->getIpPort());
+				portPool.release(game->getIpPort());
 				games.erase(games.begin() + i);
+				lobbySnapshot.invalidate();
+				lobbyEvents.gameTerminated(*game);
+				eventBus.publish(GameEvent(GameEvent::GameTerminated, *game));
+				if ((draining || terminating) && games.empty()) {
+					NOTICE_LOG("All games ended: stopping");
+					io_context.stop();
+				}
 				return;
 			}
 		ERROR_LOG("Server::deleteGame game %s [port %d] not found", game->getName().c_str(), game->getIpPort());
 	}
 
+	void startSignals()
+	{
+		signals.async_wait([this](const std::error_code& ec, int signo) {
+			if (ec)
+				return;
+			// With a handover socket, SIGTERM lets the running games end first.
+			// A new server process can still take over in the meantime.
+			if (signo == SIGTERM && !handoverPath.empty() && !terminating && !games.empty())
+			{
+				terminating = true;
+				NOTICE_LOG("Stopping once the %zd running game(s) have ended", games.size());
+				startSignals();
+				return;
+			}
+			io_context.stop();
+		});
+	}
+
+	// Starts a new server process taking over from this one on SIGUSR2 (zero-downtime restart)
+	void startRestartSignal()
+	{
+		restartSignals.async_wait([this](const std::error_code& ec, int /*signo*/) {
+			if (ec)
+				return;
+			if (handoverPath.empty())
+				WARN_LOG("Restart ignored: HandoverSocket isn't set");
+			else if (!draining)
+			{
+				pid_t pid;
+				int rc = spawnServer(pid);
+				if (rc != 0)
+					ERROR_LOG("Can't start %s: %s", ExecutablePath.c_str(), strerror(rc));
+				else
+					NOTICE_LOG("Started the new server process %d", pid);
+			}
+			startRestartSignal();
+		});
+	}
+
+	// Reloads the configuration on SIGHUP. Running games are not affected.
+	void startReloadSignal()
+	{
+		reloadSignals.async_wait([this](const std::error_code& ec, int /*signo*/) {
+			if (ec)
+				return;
+			if (loadConfig(ConfigPath))
+			{
+				applyConfig();
+				serverIp = getConfig("ServerIP", "127.0.0.1");
+				uint16_t newMin, newMax;
+				getPortRange(newMin, newMax);
+				// Ports removed from the range are closed once their game ends
+				portPool.setRange(newMin, newMax);
+				cluster.setNodes(getConfig("RelayNodes"));
+				NOTICE_LOG("Configuration reloaded: server IP %s TCP ports %d-%d", serverIp.c_str(), newMin, newMax);
+			}
+			startReloadSignal();
+		});
+	}
+
+	// Listens for a new server process taking over the listening sockets
+	void listenForHandover(const std::string& path)
+	{
+		if (path.empty())
+			return;
+		handoverPath = path;
+		unlink(path.c_str());
+		std::error_code ec;
+		handoverAcceptor.open(asio::local::stream_protocol(), ec);
+		if (!ec)
+			handoverAcceptor.bind(asio::local::stream_protocol::endpoint(path), ec);
+		if (!ec)
+			handoverAcceptor.listen(asio::socket_base::max_listen_connections, ec);
+		if (ec) {
+			ERROR_LOG("Can't create handover socket %s: %s", path.c_str(), ec.message().c_str());
+			return;
+		}
+		acceptHandover();
+	}
+
+	// Hands the HTTP socket over to the new process, then runs the current games until they end
+	void acceptHandover()
+	{
+		handoverAcceptor.async_accept([this](const std::error_code& ec, asio::local::stream_protocol::socket socket) {
+			if (ec)
+				return;
+			HandoverState state;
+			state.httpFd = httpServer.getListenFd();
+			for (const auto& game : games)
+				state.busyPorts.push_back(game->getIpPort());
+			portPool.getFreeSockets(state.gameTcpFds, state.gameUdpFds);
+			if (!sendHandover(socket.native_handle(), state)) {
+				acceptHandover();
+				return;
+			}
+			// The new process has its own copy of the idle ports
+			portPool.close();
+			// The new process is notified when this one exits and the connection is closed
+			nextServer = std::move(socket);
+			std::error_code ignored;
+			handoverAcceptor.close(ignored);
+			httpServer.stop();
+			draining = true;
+			sendGameReport();
+			NOTICE_LOG("Handed over to the new server: draining %zd game(s)", games.size());
+			if (games.empty())
+				io_context.stop();
+		});
+	}
+
+	// Sends the description of the games still running to the new process when they change,
+	// so that its lobby lists them
+	void sendGameReport()
+	{
+		if (sendingReport)
+			return;
+		std::string report;
+		writeNodeReport(report, serverIp, portPool.getPortMin(), portPool.getPortMax(), 0, games);
+		previousGames.writeGames(report);
+		if (report == sentReport)
+			return;
+		sentReport = std::move(report);
+		sentReportSize = sentReport.size();
+		sendingReport = true;
+		std::array<asio::const_buffer, 2> buffers { asio::buffer(&sentReportSize, sizeof(sentReportSize)), asio::buffer(sentReport) };
+		asio::async_write(nextServer, buffers, [this](const std::error_code& ec, size_t) {
+			sendingReport = false;
+			if (ec)
+				WARN_LOG("Can't send the game report to the new server: %s", ec.message().c_str());
+		});
+	}
+
+	// Reads the game reports of the previous process, and reclaims its ports when it exits
+	void waitForPreviousServer()
+	{
+		asio::async_read(previousServer, asio::buffer(&previousReportSize, sizeof(previousReportSize)),
+			[this](const std::error_code& ec, size_t) {
+				if (ec) {
+					previousServerStopped();
+					return;
+				}
+				if (previousReportSize > MaxReportSize) {
+					ERROR_LOG("Invalid game report from the previous server: %u bytes", previousReportSize);
+					previousServerStopped();
+					return;
+				}
+				previousReport.resize(previousReportSize);
+				asio::async_read(previousServer, asio::buffer(previousReport),
+					[this](const std::error_code& ec, size_t) {
+						if (ec) {
+							previousServerStopped();
+							return;
+						}
+						previousGames.parse(previousReport);
+						waitForPreviousServer();
+					});
+			});
+	}
+
+	void previousServerStopped()
+	{
+		previousGames = {};
+		std::vector<uint16_t> released;
+		std::swap(released, previousPorts);
+		portPool.include(released);
+		std::error_code ignored;
+		previousServer.close(ignored);
+		INFO_LOG("Previous server stopped: %zd port(s) released", released.size());
+	}
+
+	// A single timer pings all the games and times out players
+	void startTickTimer()
+	{
+		tickTimer.async_wait([this](const std::error_code& ec) {
+			if (ec)
+				return;
+			const auto now = asio::chrono::steady_clock::now();
+			CoarseClock::update(now);
+			// Backwards since games may delete themselves
+			for (size_t i = games.size(); i-- > 0; )
+			{
+				Game::Ptr game = games[i];
+				game->tick(now);
+			}
+			if (draining)
+				sendGameReport();
+			capacity.sampleMemory();
+			tickTimer.expires_at(tickTimer.expiry() + getPingInterval());
+			startTickTimer();
+		});
+	}
+
+	void playerJoined(const Game& game, int slot) override
+	{
+		lobbySnapshot.invalidate();
+		lobbyEvents.playerJoined(game, slot);
+		eventBus.publish(GameEvent(GameEvent::PlayerJoined, game, game.getPlayer(slot)->getName(), slot));
+	}
+
+	void spectatorsChanged(const Game& game) override {
+		lobbySnapshot.invalidate();
+	}
+
+	void playerLeft(const Game& game, const Player& player, int slot) override
+	{
+		lobbySnapshot.invalidate();
+		lobbyEvents.playerLeft(game, player, slot);
+		eventBus.publish(GameEvent(GameEvent::PlayerLeft, game, player.getName(), slot));
+	}
+
 private:
 	static std::vector<std::string> splitParams(const std::string& str)
 	{
@@ -320,14 +676,33 @@ private:
 					memcpy(slots.data(), &value[41], sizeof(slots));
 					std::array<uint8_t, 8> sides;
 					memcpy(sides.data(), &value[49], sizeof(sides));
-					Game::Ptr game = Game::create(*this, io_context, serverIp, ports.back());
-					ports.pop_back();
+					if (terminating) {
+						WARN_LOG("Can't create game %s: server stopping", gameName.c_str());
+						break;
+					}
+					// Lobby of a cluster: the game may be created on a relay node
+					if (cluster.createGame(capacity.getFreeGames(games.size()), request, reply))
+						return;
+					if (!capacity.admit(games.size())) {
+						WARN_LOG("Can't create game %s: server full", gameName.c_str());
+						break;
+					}
+					uint16_t port;
+					int tcpFd, udpFd;
+					if (!portPool.acquire(port, tcpFd, udpFd)) {
+						WARN_LOG("Can't create game %s: no port available", gameName.c_str());
+						break;
+					}
+					Game::Ptr game = Game::create(*this, io_context, serverIp, port, tcpFd, udpFd);
 					game->setName(gameName);
 					game->setType((Game::GameType)gameType);
 					game->setMaps(maps);
 					game->setSlots(slots);
 					games.push_back(game);
 					game->start();
+					lobbySnapshot.invalidate();
+					lobbyEvents.gameCreated(*game);
+					eventBus.publish(GameEvent(GameEvent::GameCreated, *game));
 					replyContent += game->getHttpDesc(false);
 					DEBUG_LOG("Create game: %s", replyContent.c_str());
 					replyContent += "\nCREATED\nGAMEDONE\n";
@@ -343,6 +718,8 @@ private:
 		{
 			for (const auto& game : games)
 				replyContent += game->getHttpDesc(false) + " GAMEDONE\n";
+			previousGames.appendGames(replyContent);
+			cluster.appendGames(replyContent);
 //			replyContent += "Address=146.185.135.179 Port=9407 Response=20 GameName=War is Hell GameType=3 Maps=63 "
 //									"Slots=2 0 255 255 0 0 255 255  Sides=0 0 0 0 1 1 1 1 GAMEDONE\n"
 //					"Address=146.185.135.179 Port=9408 Response=20 GameName=Alien Fest GameType=1 Maps=63 "
@@ -350,57 +727,218 @@ private:
 		}
 		else if (reqType == 1)
 		{
+			bool found = false;
 			for (const auto& game : games)
 				if (game->getIpPort() == gamePort) {
 					replyContent += game->getHttpDesc(true) + "\nGAMEDONE\n";
+					found = true;
 					break;
 				}
+			if (!found && !previousGames.appendGameDetails(gamePort, replyContent))
+				cluster.appendGameDetails(gamePort, replyContent);
 		}
 		reply.setContent(replyContent + "END\n");
 	}
 
+	void handleGamesRequest(const Request& request, Reply& reply)
+	{
+		const size_t freeGames = capacity.getFreeGames(games.size());
+		if (!lobbySnapshot.isValid() || lobbySnapshot.getFreeGames() != freeGames)
+			lobbySnapshot.update(games, freeGames);
+		const std::string *acceptEncoding = request.getHeader("Accept-Encoding");
+		if (acceptEncoding != nullptr && acceptEncoding->find("gzip") != std::string::npos
+				&& lobbySnapshot.getGzipJson() != nullptr)
+		{
+			reply.setContent(lobbySnapshot.getGzipJson(), "application/json");
+			reply.addHeader("Content-Encoding", "gzip");
+		}
+		else {
+			reply.setContent(lobbySnapshot.getJson(), "application/json");
+		}
+		reply.addHeader("Vary", "Accept-Encoding");
+		reply.addHeader("Access-Control-Allow-Origin", "*");
+	}
+
+	void handleMetricsRequest(const Request& request, Reply& reply)
+	{
+		// Reuse the buffer unless a previous reply is still being sent
+		if (metricsBuffer == nullptr || metricsBuffer.use_count() > 1)
+			metricsBuffer = std::make_shared<std::string>();
+		MetricsWriter writer(*metricsBuffer);
+		char labels[64];
+
+		int players = 0;
+		size_t spectators = 0;
+		for (const auto& game : games) {
+			players += game->getPlayerCount();
+			spectators += game->getSpectatorCount();
+		}
+		writer.header("afo_games_active", "gauge", "Number of running games");
+		writer.sample("afo_games_active", nullptr, (uint64_t)games.size());
+		writer.header("afo_game_ports_free", "gauge", "Number of game ports available");
+		writer.sample("afo_game_ports_free", nullptr, (uint64_t)portPool.available());
+		writer.header("afo_games_free", "gauge", "Number of games that can still be created");
+		writer.sample("afo_games_free", nullptr, (uint64_t)capacity.getFreeGames(games.size()));
+		writer.header("afo_games_max", "gauge", "Maximum number of games, 0 if unlimited");
+		writer.sample("afo_games_max", nullptr, (uint64_t)Capacity::getMaxGames());
+		writer.header("afo_games_rejected_total", "counter", "Games not created because the server was full");
+		writer.sample("afo_games_rejected_total", nullptr, capacity.getRejectedCount());
+		writer.header("afo_cluster_nodes_up", "gauge", "Number of relay nodes reachable by the lobby");
+		writer.sample("afo_cluster_nodes_up", nullptr, (uint64_t)cluster.getNodesUp());
+		writer.header("afo_cluster_games", "gauge", "Number of games running on the relay nodes");
+		writer.sample("afo_cluster_games", nullptr, (uint64_t)cluster.getGameCount());
+		writer.header("afo_cluster_games_forwarded_total", "counter", "Game creations forwarded to relay nodes");
+		writer.sample("afo_cluster_games_forwarded_total", nullptr, cluster.getForwardedCount());
+		writer.header("afo_cluster_forward_errors_total", "counter", "Game creations that failed on relay nodes");
+		writer.sample("afo_cluster_forward_errors_total", nullptr, cluster.getForwardErrors());
+		writer.header("afo_memory_resident_bytes", "gauge", "Resident memory of the server");
+		writer.sample("afo_memory_resident_bytes", nullptr, (uint64_t)capacity.getResidentMemory());
+		writer.header("afo_memory_budget_bytes", "gauge", "Memory budget of the server, 0 if unlimited");
+		writer.sample("afo_memory_budget_bytes", nullptr, (uint64_t)Capacity::getMemoryBudget());
+		writer.header("afo_players_connected", "gauge", "Number of players in games");
+		writer.sample("afo_players_connected", nullptr, (uint64_t)players);
+		writer.header("afo_spectators_connected", "gauge", "Number of spectators");
+		writer.sample("afo_spectators_connected", nullptr, (uint64_t)spectators);
+
+		writer.header("afo_http_requests_total", "counter", "HTTP requests by handler path and status");
+		for (const auto& [key, count] : httpServer.getRequestCounts())
+		{
+			snprintf(labels, sizeof(labels), "path=\"%s\",status=\"%d\"", key.first.c_str(), key.second);
+			writer.sample("afo_http_requests_total", labels, count);
+		}
+		writer.header("afo_db_query_duration_seconds", "histogram", "Database query latency");
+		writer.histogram("afo_db_query_duration_seconds", nullptr, getDbQueryLatency());
+		writer.header("afo_event_subscribers", "gauge", "Number of clients connected to the lobby event stream");
+		writer.sample("afo_event_subscribers", nullptr, (uint64_t)lobbyEvents.getEventSource().getSubscriberCount());
+		writer.header("afo_discord_queue_depth", "gauge", "Discord notifications being sent");
+		writer.sample("afo_discord_queue_depth", nullptr, (uint64_t)getDiscordQueueDepth());
+		writer.header("afo_discord_requests_in_flight", "gauge", "Discord webhook requests in progress");
+		writer.sample("afo_discord_requests_in_flight", nullptr, (uint64_t)getDiscordInFlight());
+		writer.header("afo_log_dropped_total", "counter", "Log messages that couldn't be written");
+		writer.sample("afo_log_dropped_total", nullptr, getLogDropCount());
+		writer.header("afo_capture_dropped_total", "counter", "Capture records dropped because the disk was too slow");
+		writer.sample("afo_capture_dropped_total", nullptr, getCaptureDropCount());
+
+		// UDP relay
+		const RelayStats relayStats = RelayStats::global();
+		writer.header("afo_udp_packets_in_total", "counter", "UDP packets received from players by opcode");
+		for (int op = 0; op < RelayStats::OpCount; op++)
+		{
+			snprintf(labels, sizeof(labels), "opcode=\"%s\"", RelayStats::opcodeName((RelayStats::Opcode)op));
+			writer.sample("afo_udp_packets_in_total", labels, relayStats.packetsIn[op]);
+		}
+		writer.header("afo_udp_packets_out_total", "counter", "UDP packets sent by opcode");
+		for (int op = 0; op < RelayStats::OpCount; op++)
+		{
+			snprintf(labels, sizeof(labels), "opcode=\"%s\"", RelayStats::opcodeName((RelayStats::Opcode)op));
+			writer.sample("afo_udp_packets_out_total", labels, relayStats.packetsOut[op]);
+		}
+		writer.header("afo_udp_bytes_in_total", "counter", "UDP bytes received from players");
+		writer.sample("afo_udp_bytes_in_total", nullptr, relayStats.bytesIn);
+		writer.header("afo_udp_bytes_out_total", "counter", "UDP bytes sent");
+		writer.sample("afo_udp_bytes_out_total", nullptr, relayStats.bytesOut);
+		writer.header("afo_udp_send_errors_total", "counter", "UDP send errors");
+		writer.sample("afo_udp_send_errors_total", nullptr, relayStats.sendErrors);
+		writer.header("afo_udp_unknown_source_total", "counter", "UDP packets received from unknown sources");
+		writer.sample("afo_udp_unknown_source_total", nullptr, relayStats.unknownSource);
+		writer.header("afo_udp_spectator_drops_total", "counter", "UDP packets not sent to spectators because of congestion");
+		writer.sample("afo_udp_spectator_drops_total", nullptr, relayStats.spectatorDrops);
+		writer.header("afo_udp_fanout_duration_seconds", "histogram", "Time from UDP packet reception to the end of its fan-out, for 1 packet in 16");
+		writer.histogram("afo_udp_fanout_duration_seconds", nullptr, relayStats.fanoutLatency);
+
+		// Per game
+		writer.header("afo_game_players", "gauge", "Number of players in the game");
+		for (const auto& game : games)
+		{
+			snprintf(labels, sizeof(labels), "port=\"%d\"", game->getIpPort());
+			writer.sample("afo_game_players", labels, (uint64_t)game->getPlayerCount());
+		}
+		writer.header("afo_game_udp_packets_in_total", "counter", "UDP packets received from the game players by opcode");
+		for (const auto& game : games)
+			for (int op = 0; op < RelayStats::OpCount; op++)
+			{
+				snprintf(labels, sizeof(labels), "port=\"%d\",opcode=\"%s\"", game->getIpPort(),
+						RelayStats::opcodeName((RelayStats::Opcode)op));
+				writer.sample("afo_game_udp_packets_in_total", labels, game->getStats().packetsIn[op]);
+			}
+		writer.header("afo_game_udp_packets_out_total", "counter", "UDP packets sent to the game players by opcode");
+		for (const auto& game : games)
+			for (int op = 0; op < RelayStats::OpCount; op++)
+			{
+				snprintf(labels, sizeof(labels), "port=\"%d\",opcode=\"%s\"", game->getIpPort(),
+						RelayStats::opcodeName((RelayStats::Opcode)op));
+				writer.sample("afo_game_udp_packets_out_total", labels, game->getStats().packetsOut[op]);
+			}
+		writer.header("afo_game_udp_send_errors_total", "counter", "UDP send errors in the game");
+		for (const auto& game : games)
+		{
+			snprintf(labels, sizeof(labels), "port=\"%d\"", game->getIpPort());
+			writer.sample("afo_game_udp_send_errors_total", labels, game->getStats().sendErrors);
+		}
+		writer.header("afo_game_udp_unknown_source_total", "counter", "UDP packets received from unknown sources in the game");
+		for (const auto& game : games)
+		{
+			snprintf(labels, sizeof(labels), "port=\"%d\"", game->getIpPort());
+			writer.sample("afo_game_udp_unknown_source_total", labels, game->getStats().unknownSource);
+		}
+		writer.header("afo_game_slot_last_seen_seconds", "gauge", "Time since the last UDP packet received from the player");
+		for (const auto& game : games)
+			for (int slot = 0; slot < 8; slot++)
+			{
+				if (game->getPlayer(slot) == nullptr)
+					continue;
+				snprintf(labels, sizeof(labels), "port=\"%d\",slot=\"%d\"", game->getIpPort(), slot);
+				writer.sample("afo_game_slot_last_seen_seconds", labels,
+						asio::chrono::duration<double>(game->getLastSeenAge(slot)).count());
+			}
+		writer.header("afo_game_udp_fanout_duration_seconds", "histogram", "Time from UDP packet reception to the end of its fan-out in the game, for 1 packet in 16");
+		for (const auto& game : games)
+		{
+			snprintf(labels, sizeof(labels), "port=\"%d\"", game->getIpPort());
+			writer.histogram("afo_game_udp_fanout_duration_seconds", labels, game->getStats().fanoutLatency);
+		}
+
+		reply.setContent(metricsBuffer, "text/plain; version=0.0.4");
+	}
+
 private:
 	asio::io_context& io_context;
 	std::string serverIp;
 
 	/// The signal_set is used to register for process termination notifications.
 	asio::signal_set signals;
+	asio::signal_set reloadSignals;
+	asio::signal_set restartSignals;
+	asio::steady_timer tickTimer;
 
 	HttpServer httpServer;
 	std::vector<Game::Ptr> games;
-	std::vector<uint16_t> ports;
-};
+	std::shared_ptr<std::string> metricsBuffer;
+	LobbySnapshot lobbySnapshot;
+	LobbyEvents lobbyEvents;
+	EventBus eventBus;
 
-static void loadConfig(const std::string& path)
-{
-	std::filebuf fb;
-	if (!fb.open(path, std::ios::in)) {
-		ERROR_LOG("config file %s not found", path.c_str());
-		return;
-	}
-
-	std::istream istream(&fb);
-	std::string line;
-	while (std::getline(istream, line))
-	{
-		if (line.empty() || line[0] == '#')
-			continue;
-		auto pos = line.find_first_of("=:");
-		if (pos != std::string::npos)
-			Config[line.substr(0, pos)] = line.substr(pos + 1);
-		else
-			ERROR_LOG("config file syntax error: %s", line.c_str());
-	}
-}
-
-std::string getConfig(const std::string& name, const std::string& default_value = "")
-{
-	auto it = Config.find(name);
-	if (it == Config.end())
-		return default_value;
-	else
-		return it->second;
-}
+	// Zero-downtime restart
+	asio::local::stream_protocol::acceptor handoverAcceptor;
+	asio::local::stream_protocol::socket previousServer;
+	asio::local::stream_protocol::socket nextServer;
+	std::vector<uint16_t> previousPorts;
+	std::string handoverPath;
+	bool draining = false;		// handed over to a new process
+	bool terminating = false;	// SIGTERM received, waiting for the games to end
+	// Games still running in the previous process
+	NodeReport previousGames;
+	uint32_t previousReportSize = 0;
+	std::string previousReport;
+	// Last report sent to the new process
+	uint32_t sentReportSize = 0;
+	std::string sentReport;
+	bool sendingReport = false;
+	static constexpr uint32_t MaxReportSize = 1024 * 1024;
+	PortPool portPool;
+	Capacity capacity;
+	ClusterLobby cluster;
+};
 
 int main(int argc, char *argv[])
 {
@@ -409,24 +947,44 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "Usage: %s [<config file path>]\n", argv[0]);
 		return 1;
 	}
-	loadConfig(argc < 2 ? "afo.cfg" : argv[1]);
+	// Resolved now so that a restart neither depends on the working directory and PATH
+	// nor misses a binary installed in place of this one
+	char exePath[PATH_MAX];
+	ssize_t exeLen = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+	ExecutablePath = exeLen > 0 ? std::string(exePath, exeLen) : std::string("/proc/self/exe");
+	ConfigPath = argc < 2 ? "afo.cfg" : argv[1];
+	loadConfig(ConfigPath);
 	setDatabasePath(getConfig("DatabasePath", "afo.db"));
-	setDiscordWebhook(getConfig("DiscordWebhook"));
+	setEventLog(getConfig("EventLog"));
+	setEventSocket(getConfig("EventSocket"));
+	KernelForwarder::init(getConfig("KernelForwarding"));
+	applyConfig();
 	std::string serverIp = getConfig("ServerIP", "127.0.0.1");
-	std::string serverPorts = getConfig("ServerPorts", "9400-9419");
-	size_t pos = serverPorts.find('-');
-	uint16_t portMin = 9400;
-	uint16_t portMax = 9419;
-	if (pos != std::string::npos)
-	{
-		portMin = atoi(serverPorts.substr(0, pos).c_str());
-		portMax = atoi(serverPorts.substr(pos + 1).c_str());
-	}
+	uint16_t httpPort = atoi(getConfig("HttpPort", "8080").c_str());
+	uint16_t portMin, portMax;
+	getPortRange(portMin, portMax);
+	ActivatedSockets activated;
+	getActivatedSockets(httpPort, activated);
+	std::string handoverSocket = getConfig("HandoverSocket");
+	HandoverState handover;
+	if (receiveHandover(handoverSocket, handover) && activated.httpFd >= 0)
+		close(activated.httpFd);
+	else if (handover.httpFd < 0)
+		handover.httpFd = activated.httpFd;
+	// The idle ports of the previous process are used like activated sockets
+	addSockets(activated.gameTcpFds, handover.gameTcpFds);
+	addSockets(activated.gameUdpFds, handover.gameUdpFds);
 	NOTICE_LOG("Alien Front Online server started");
 	NOTICE_LOG("Server IP %s TCP ports %d-%d UDP ports %d-%d", serverIp.c_str(), portMin, portMax, portMin + 1, portMax + 1);
 	try {
 		asio::io_context io_context;
-		ServerImpl server(io_context, serverIp, portMin, portMax);
+		ServerImpl server(io_context, serverIp, httpPort, portMin, portMax, handover, activated);
+		server.listenForHandover(handoverSocket);
+		if (handover.connectionFd >= 0)
+			// Started by the previous process, which will exit once its games have ended
+			notifyServiceManager("MAINPID=" + std::to_string(getpid()) + "\nREADY=1");
+		else
+			notifyServiceManager("READY=1");
 		io_context.run();
 	}
 	catch (const std::exception& e) {
@@ -18,6 +18,8 @@
 */
 #pragma once
 #include <memory>
+#include <new>
+#include <cstddef>
 
 template<typename T>
 class SharedThis : public std::enable_shared_from_this<T>
@@ -25,9 +27,11 @@ class SharedThis : public std::enable_shared_from_this<T>
 public:
 	using Ptr = std::shared_ptr<T>;
 
+	/// Allocates the object and its shared_ptr control block in a single block
+	/// taken from a free list of recycled blocks.
 	template<typename... Args>
 	static Ptr create(Args&&... args) {
-		return Ptr(new T(std::forward<Args>(args)...));
+		return std::allocate_shared<T>(Allocator<T>(), std::forward<Args>(args)...);
 	}
 
 protected:
@@ -35,4 +39,101 @@ protected:
 
 	SharedThis() {
 	}
+
+private:
+	/// Per-thread list of free memory blocks of a given size.
+	/// At most MaxFree blocks are kept, the others are returned to the heap.
+	template<size_t Size>
+	class FreeList
+	{
+	public:
+		static FreeList& instance() {
+			static thread_local FreeList freeList;
+			return freeList;
+		}
+
+		~FreeList()
+		{
+			while (head != nullptr)
+			{
+				Block *next = head->next;
+				::operator delete(head);
+				head = next;
+			}
+		}
+
+		void *allocate()
+		{
+			if (head == nullptr)
+				return ::operator new(Size);
+			Block *block = head;
+			head = block->next;
+			count--;
+			return block;
+		}
+
+		void deallocate(void *p)
+		{
+			if (count >= MaxFree) {
+				::operator delete(p);
+				return;
+			}
+			Block *block = static_cast<Block *>(p);
+			block->next = head;
+			head = block;
+			count++;
+		}
+
+	private:
+		struct Block {
+			Block *next;
+		};
+		static_assert(Size >= sizeof(Block), "Block size too small");
+		static constexpr size_t MaxFree = 64;
+
+		Block *head = nullptr;
+		size_t count = 0;
+	};
+
+	// Nested so that it can use the private constructor of T
+	template<typename U>
+	struct Allocator
+	{
+		using value_type = U;
+
+		Allocator() = default;
+		template<typename V>
+		Allocator(const Allocator<V>&) {}
+
+		U *allocate(size_t n)
+		{
+			static_assert(alignof(U) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "Over-aligned type");
+			if (n != 1)
+				return static_cast<U *>(::operator new(n * sizeof(U)));
+			return static_cast<U *>(FreeList<sizeof(U)>::instance().allocate());
+		}
+
+		void deallocate(U *p, size_t n)
+		{
+			if (n != 1)
+				::operator delete(p);
+			else
+				FreeList<sizeof(U)>::instance().deallocate(p);
+		}
+
+		template<typename V, typename... Args>
+		void construct(V *p, Args&&... args) {
+			::new((void *)p) V(std::forward<Args>(args)...);
+		}
+
+		template<typename V>
+		void destroy(V *p) {
+			p->~V();
+		}
+
+		template<typename V>
+		bool operator==(const Allocator<V>&) const { return true; }
+		template<typename V>
+		bool operator!=(const Allocator<V>&) const { return false; }
+	};
 };
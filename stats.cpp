@@ -0,0 +1,115 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include "stats.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+void LatencyHistogram::add(const LatencyHistogram& other)
+{
+	for (size_t i = 0; i < BucketCount; i++)
+		counts[i] += other.counts[i];
+	total += other.total;
+	sum += other.sum;
+	maxValue = std::max(maxValue, other.maxValue);
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t idx)
+{
+	if (idx < SubBucketCount)
+		return idx;
+	const int shift = idx / SubBucketCount - 1;
+	const uint64_t subBucket = idx % SubBucketCount;
+	return (((SubBucketCount | subBucket) + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::percentile(double pct) const
+{
+	if (total == 0)
+		return 0;
+	uint64_t target = (uint64_t)(pct / 100.0 * total);
+	if (target >= total)
+		target = total - 1;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < BucketCount; i++)
+	{
+		seen += counts[i];
+		if (seen > target)
+			return std::min(bucketUpperBound(i), maxValue);
+	}
+	return maxValue;
+}
+
+uint64_t LatencyHistogram::countAtOrBelow(uint64_t value) const
+{
+	uint64_t n = 0;
+	for (size_t i = 0; i < BucketCount && bucketUpperBound(i) <= value; i++)
+		n += counts[i];
+	return n;
+}
+
+const char *RelayStats::opcodeName(Opcode op)
+{
+	switch (op)
+	{
+	case Op78: return "78";
+	case Op03: return "03";
+	case Op00: return "00";
+	default: return "other";
+	}
+}
+
+void RelayStats::add(const RelayStats& other)
+{
+	for (int i = 0; i < OpCount; i++) {
+		packetsIn[i] += other.packetsIn[i];
+		packetsOut[i] += other.packetsOut[i];
+	}
+	bytesIn += other.bytesIn;
+	bytesOut += other.bytesOut;
+	sendErrors += other.sendErrors;
+	unknownSource += other.unknownSource;
+	spectatorDrops += other.spectatorDrops;
+	fanoutLatency.add(other.fanoutLatency);
+}
+
+// Per-thread counters are registered here so they can be aggregated on demand.
+// The counters of exiting threads are kept.
+static std::mutex registryMutex;
+static std::vector<std::shared_ptr<RelayStats>> registry;
+
+RelayStats& RelayStats::local()
+{
+	thread_local std::shared_ptr<RelayStats> stats = []() {
+		auto stats = std::make_shared<RelayStats>();
+		std::lock_guard<std::mutex> _(registryMutex);
+		registry.push_back(stats);
+		return stats;
+	}();
+	return *stats;
+}
+
+RelayStats RelayStats::global()
+{
+	RelayStats total;
+	std::lock_guard<std::mutex> _(registryMutex);
+	for (const auto& stats : registry)
+		total.add(*stats);
+	return total;
+}
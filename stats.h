@@ -0,0 +1,115 @@
+/*
+	Game server for Alien Front Online.
+    Copyright (C) 2025  Flyinghead
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <array>
+
+/// Log-linear histogram of latencies in nanoseconds with about 6% precision (HDR style).
+/// Not thread-safe.
+class LatencyHistogram
+{
+public:
+	void record(uint64_t ns)
+	{
+		counts[bucketIndex(ns)]++;
+		total++;
+		sum += ns;
+		if (ns > maxValue)
+			maxValue = ns;
+	}
+
+	void add(const LatencyHistogram& other);
+
+	uint64_t count() const { return total; }
+	uint64_t getSum() const { return sum; }
+	uint64_t max() const { return maxValue; }
+	/// Returns the upper bound of the bucket containing the given percentile (0 to 100)
+	uint64_t percentile(double pct) const;
+	/// Returns the number of values less than or equal to the given value (with bucket precision)
+	uint64_t countAtOrBelow(uint64_t value) const;
+
+	static constexpr size_t BucketCount = 38 * 16;
+	uint64_t bucketCount(size_t idx) const { return counts[idx]; }
+	/// Returns the highest value counted in the given bucket
+	static uint64_t bucketUpperBound(size_t idx);
+	/// Returns the upper bound of the bucket containing the given value.
+	/// countAtOrBelow() is exact for this bound.
+	static uint64_t roundUpToBucket(uint64_t value) {
+		return bucketUpperBound(bucketIndex(value));
+	}
+
+private:
+	static constexpr int SubBucketBits = 4;
+	static constexpr uint64_t SubBucketCount = 1 << SubBucketBits;
+
+	static size_t bucketIndex(uint64_t v)
+	{
+		if (v < SubBucketCount)
+			return v;
+		int shift = 63 - __builtin_clzll(v) - SubBucketBits;
+		size_t idx = (shift + 1) * SubBucketCount + ((v >> shift) & (SubBucketCount - 1));
+		return idx < BucketCount ? idx : BucketCount - 1;
+	}
+
+	std::array<uint64_t, BucketCount> counts {};
+	uint64_t total = 0;
+	uint64_t sum = 0;
+	uint64_t maxValue = 0;
+};
+
+/// UDP relay counters. Updated without synchronization by the thread owning the games.
+struct RelayStats
+{
+	enum Opcode {
+		Op78,
+		Op03,
+		Op00,
+		OpOther,
+		OpCount
+	};
+	static Opcode opcode(uint8_t op)
+	{
+		switch (op)
+		{
+		case 0x78: return Op78;
+		case 0x03: return Op03;
+		case 0x00: return Op00;
+		default: return OpOther;
+		}
+	}
+	static const char *opcodeName(Opcode op);
+
+	std::array<uint64_t, OpCount> packetsIn {};
+	std::array<uint64_t, OpCount> packetsOut {};
+	uint64_t bytesIn = 0;
+	uint64_t bytesOut = 0;
+	uint64_t sendErrors = 0;
+	uint64_t unknownSource = 0;
+	/// Packets dropped from the spectator queue
+	uint64_t spectatorDrops = 0;
+	/// Time from packet reception to the end of the fan-out to the other players
+	LatencyHistogram fanoutLatency;
+
+	void add(const RelayStats& other);
+
+	/// Returns the counters of the calling thread
+	static RelayStats& local();
+	/// Returns the sum of the counters of all threads
+	static RelayStats global();
+};